@@ -0,0 +1,69 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <render.h>
+#include <stats.h>
+#include <master.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Checkpoints of a render to a file, so it can continue where it was interrupted.
+ * The voices at any point follow from the timeline, so a checkpoint only needs the position, and the state which
+ * depends on everything rendered before: the stats, and the master stage.
+ * A checkpoint is only valid for the same timeline rendered with the same config, which is checked using a hash.
+ */
+#define CHECKPOINT_MAGIC "DPATRKCP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_BYTE_ORDER 0x01020304u
+// Seconds of audio between checkpoints
+#define CHECKPOINT_DEFAULT_INTERVAL 60
+
+struct checkpoint_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t identity;
+  uint64_t time;    // Samples of the mix rendered
+  uint64_t written; // Samples written to the output
+  // Stats
+  int64_t min, max;
+  uint64_t peak;
+  uint64_t samples_total;
+  uint64_t abs_sum[2], square_sum[2]; // Low and high halves
+  uint64_t voices_max;
+  double true_peak;
+  double history[STATS_TRUE_PEAK_TAPS-1];
+  // Master stage, followed by size entries of its delay, hold and minimum arrays if it has a limiter
+  uint64_t master_length, master_in, master_out;
+  int64_t hold_sum, held;
+  uint64_t size, minimum_first, minimum_count;
+};
+
+struct checkpoint {
+  const char* path;
+  uint64_t identity; // of the timeline and the config
+  uint64_t interval; // in samples
+  // Where the render continues, set by checkpoint_load
+  uint64_t time;
+  uint64_t written;
+  bool has_master;   // master holds the restored stage, render_timeline takes it over
+  struct master master;
+};
+
+// Hash of everything the rendered samples depend on
+uint64_t checkpoint_identity(const struct render_config* config, const struct timeline* timeline);
+
+/*
+ * Restores the stats and the state of the master stage from the checkpoint at checkpoint->path.
+ * Returns 0 on success, 1 if there is no checkpoint for this render, and -1 on other errors.
+ */
+int checkpoint_load(struct checkpoint* checkpoint, const struct render_config* config, struct stats* stats);
+// Replaces the checkpoint. The output up to written samples must already be on disk.
+int checkpoint_save(const struct checkpoint* checkpoint, uint64_t time, uint64_t written, const struct stats* stats, const struct master* master);
+// Removes the checkpoint once the render is complete
+int checkpoint_remove(const struct checkpoint* checkpoint);
+void checkpoint_destroy(struct checkpoint* checkpoint);
+
+#endif
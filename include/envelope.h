@@ -0,0 +1,47 @@
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENVELOPE_TYPES \
+  X(ENVELOPE_DECAY, "decay") \
+  X(ENVELOPE_ADSR, "adsr")
+
+enum envelope_type {
+#define X(N, S) N,
+  ENVELOPE_TYPES
+#undef X
+  ENVELOPE_TYPE_COUNT
+};
+
+extern const char*const envelope_type_name[ENVELOPE_TYPE_COUNT];
+
+// Full gain
+#define ENVELOPE_MAX 0x7FFF
+
+// The envelope is evaluated exactly every 2^ENVELOPE_STEP_LOG2 samples, and interpolated linearly in between
+#define ENVELOPE_STEP_LOG2 5
+#define ENVELOPE_STEP (1u << ENVELOPE_STEP_LOG2)
+
+/*
+ * ENVELOPE_DECAY: The gain halves after decay samples, and keeps falling hyperbolically, decay / (time + decay).
+ * ENVELOPE_ADSR: The gain rises linearly to the maximum in attack samples, falls linearly to sustain in decay samples,
+ *                and stays there until the note is released. From there, it falls linearly to 0 in release samples.
+ */
+struct envelope {
+  uint8_t type;
+  uint16_t sustain; // Gain, up to ENVELOPE_MAX
+  uint32_t attack, decay, release; // in samples
+};
+
+// The gain at time samples after the start of a note which is released after gate samples
+int32_t envelope_value(const struct envelope* envelope, uint64_t gate, uint64_t time);
+
+/*
+ * Computes the gain of the n samples starting at time.
+ * The result only depends on the time since the start of the note, not on how the note is split into blocks.
+ */
+void envelope_render(const struct envelope* envelope, uint64_t gate, uint64_t time, size_t n, int32_t gain[restrict n]);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <output.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MASTER_DEFAULT_LOOKAHEAD_MS 5
+#define MASTER_DEFAULT_RELEASE_MS 50
+// Gains of the limiter are fixed point, with this being 1
+#define MASTER_GAIN_ONE ((int64_t)1 << 30)
+
+/*
+ * The last stage before the samples are converted to the output format.
+ * The mix is multiplied by gain, then the limiter keeps it below the ceiling, and the result is rounded to the
+ * resolution of the output format, with TPDF dither if enabled.
+ */
+struct master_config {
+  double gain;        // 1 leaves the mix unchanged
+  double ceiling;     // Largest absolute output, in mix units. 0 disables the limiter
+  uint32_t lookahead; // in samples, the output is delayed by this much less one
+  uint32_t release;   // Samples it takes the limiter to go back from no gain at all to full gain
+  bool dither;
+};
+
+/*
+ * The limiter holds the smallest gain needed by any sample in the look-ahead window, and smooths it with a moving
+ * average over the same window. Every gain averaged for a sample was held while that sample was in the window, so
+ * the output never exceeds the ceiling, and the gain changes without clicks.
+ */
+struct master {
+  struct master_config config;
+  int64_t quantum; // Resolution of the output format in mix units, 0 for float formats
+  uint64_t length; // Position in the timeline after the mix consumed
+  uint64_t in;     // Samples fed to the limiter, including the silence after the end
+  uint64_t out;    // Position in the timeline of the next sample produced
+  // Limiter state, one entry per sample of the look-ahead window
+  size_t size;
+  double* delay;    // Samples waiting to be output, after the gain
+  int64_t* hold;    // Held gains being averaged
+  int64_t hold_sum;
+  int64_t held;     // Gain held for the newest sample
+  // Smallest gains needed in the window, increasing, with the sample they're needed for
+  struct master_minimum {
+    uint64_t position;
+    int64_t gain;
+  }* minimum;
+  size_t minimum_first, minimum_count;
+};
+
+// Whether the stage changes the samples at all, if not it can be skipped
+bool master_enabled(const struct master_config* config, enum output_format format);
+bool master_init(struct master* master, const struct master_config* config, enum output_format format);
+// Starts the stage at time in the timeline instead of 0, the dither depends on it. Call right after master_init
+void master_start(struct master* master, uint64_t time);
+/*
+ * Processes n mixed samples in place. The first samples are held back by the limiter, so fewer may come out.
+ * Returns the number of samples written to the start of mix.
+ */
+size_t master_process(struct master* master, size_t n, int64_t mix[n]);
+// Writes up to n of the samples still held back after the end of the mix, returns how many
+size_t master_flush(struct master* master, size_t n, int64_t mix[n]);
+void master_destroy(struct master* master);
+
+#endif
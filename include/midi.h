@@ -253,6 +253,7 @@ struct midi_event_parser {
   uint64_t time;
   uint32_t tmp;
   uint8_t state;
+  uint8_t running_status; // Status of the last channel message, 0 if there is none
   bool has_timing;
   struct midi_event event;
   bool got_event;
@@ -260,6 +261,17 @@ struct midi_event_parser {
 
 #define midi_message_has_channel(X) ((X) < 0x90)
 
+/*
+ * Parses the data up to the next event, which is stored in midi->event if midi->got_event is set.
+ * Returns the number of bytes consumed, or -1 on invalid data. Incomplete events at the end are left for the next
+ * call, which must start where this one stopped, unless eof is set.
+ */
 ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof);
+/*
+ * Like midi_event_parser_parse, but parses up to capacity events into events, and sets count to their number.
+ * The data of the events points into data, so it must not be discarded before they were handled.
+ * If there are events before invalid data, they are returned, and the next call returns -1.
+ */
+ssize_t midi_event_parser_parse_batch(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof, size_t capacity, struct midi_event events[capacity], size_t* count);
 
 #endif
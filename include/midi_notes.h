@@ -0,0 +1,58 @@
+#ifndef MIDI_NOTES_H
+#define MIDI_NOTES_H
+
+#include <midi.h>
+#include <pool.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIDI_CHANNEL_COUNT 16
+#define MIDI_KEY_COUNT 128
+
+// Names of the keys of an octave, as notes of the tracker
+extern const char*const midi_key_name[12];
+
+// The octave of a key in the notation of the tracker, key 60 is the middle c, c 4
+static inline int midi_key_octave(uint8_t key){
+  return key / 12 - 1;
+}
+
+/*
+ * Pairs the note ons and note offs of MIDI events. A note off ends the note of its channel and key which started first.
+ * The notes come out in the order they start, once they and all notes before them ended.
+ * Times are in whatever unit the caller uses.
+ */
+struct midi_note {
+  struct midi_note* next;          // In the order the notes start
+  struct midi_note* next_same_key; // Active notes of the same channel and key, in the order they started
+  bool done;
+  enum midi_channel channel;
+  uint64_t time;
+  uint64_t duration;
+  uint8_t key;
+  uint8_t velocity_start;
+  uint8_t velocity_end;
+};
+
+struct midi_notes {
+  struct pool pool;
+  struct midi_note *first, *last;
+  // The notes which didn't end yet for each channel and key
+  struct midi_note_queue {
+    struct midi_note *first, *last;
+  } active[MIDI_CHANNEL_COUNT][MIDI_KEY_COUNT];
+};
+
+void midi_notes_init(struct midi_notes* notes);
+bool midi_notes_start(struct midi_notes* notes, enum midi_channel channel, uint64_t time, uint8_t key, uint8_t velocity);
+// Returns false if no note of the channel and key is active
+bool midi_notes_stop(struct midi_notes* notes, enum midi_channel channel, uint64_t time, uint8_t key, uint8_t velocity);
+/*
+ * The first note once it ended, 0 otherwise. With flush, a note which didn't end yet is ended at time instead.
+ * The note must be released with midi_notes_free.
+ */
+struct midi_note* midi_notes_next(struct midi_notes* notes, bool flush, uint64_t time);
+void midi_notes_free(struct midi_notes* notes, struct midi_note* note);
+void midi_notes_destroy(struct midi_notes* notes);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef OSCILLATOR_H
+#define OSCILLATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAVEFORMS \
+  X(WAVEFORM_SIN, "sin") \
+  X(WAVEFORM_TRIANGLE, "triangle") \
+  X(WAVEFORM_SQUARE, "square")
+
+enum waveform {
+#define X(N, S) N,
+  WAVEFORMS
+#undef X
+  WAVEFORM_COUNT
+};
+
+extern const char*const waveform_name[WAVEFORM_COUNT];
+
+// Sample of one period of a waveform, f is in the range [0, 1)
+typedef int16_t sample_generator_t(long double f);
+extern sample_generator_t sg_sin;
+extern sample_generator_t sg_triangle;
+extern sample_generator_t sg_square;
+
+/*
+ * Renders n samples of a waveform using a phase accumulator.
+ * A phase of 2^32 is one period. out[i] is the sample at phase + i * increment.
+ */
+typedef void oscillator_kernel_t(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment);
+
+struct oscillator {
+  const char* name;
+  oscillator_kernel_t* kernel[WAVEFORM_COUNT];
+};
+
+/*
+ * "exact" evaluates the sample generators above for every sample, and is meant as a reference.
+ * The others approximate the sine with a polynomial in float precision. Its absolute error is below 7.5e-7,
+ * so after the conversion to 16 bit, they differ from the reference by at most 1.
+ * "scalar", "sse2" and "avx2" produce exactly the same samples.
+ */
+extern const struct oscillator oscillator_exact;
+extern const struct oscillator oscillator_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+#define OSCILLATOR_X86
+extern const struct oscillator oscillator_sse2;
+extern const struct oscillator oscillator_avx2;
+#endif
+
+// Returns the oscillator with the given name, or the fastest one the CPU supports for "auto".
+// Returns 0 if there is no such oscillator or if the CPU doesn't support it.
+const struct oscillator* oscillator_lookup(const char* name);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define OUTPUT_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define OUTPUT_MIN_BLOCK_SIZE     (4 * 1024)
+#define OUTPUT_MAX_BLOCK_SIZE     (64 * 1024 * 1024)
+
+// Size of the file window mapped at once when writing to a regular file
+#define OUTPUT_MAP_WINDOW (16 * 1024 * 1024)
+
+#define OUTPUT_FORMATS \
+  X(F_FLOAT_64, "float64") \
+  X(F_FLOAT_32, "float32") \
+  X(F_INT_32, "int32") \
+  X(F_INT_24, "int24") \
+  X(F_INT_16, "int16")
+
+enum output_format {
+#define X(N, S) N,
+  OUTPUT_FORMATS
+#undef X
+  OUTPUT_FORMAT_COUNT
+};
+
+extern const char*const output_format_name[OUTPUT_FORMAT_COUNT];
+
+/*
+ * Buffered sink for the rendered audio.
+ * Data is collected into a block of block_size bytes, and written using a single write / writev call once full.
+ * If the output is a regular file, the file is instead grown and mapped window by window, and the data is
+ * written directly into the mapping, no write syscalls needed at all.
+ */
+struct output {
+  int fd;
+  size_t block_size;
+  // Buffered mode
+  unsigned char* buffer;
+  size_t fill;
+  // Mapped mode
+  bool mapped;
+  int map_fd;       // fd, or the same file opened read-write if fd was write only
+  unsigned char* map;
+  off_t map_offset; // File offset of the start of the mapping
+  size_t map_size;
+  off_t position;   // File offset of the next byte to be written
+};
+
+int output_init(struct output* out, int fd, size_t block_size, bool allow_mmap);
+// Returns a pointer to at least len bytes which can be written to, len must not exceed the block size
+void* output_reserve(struct output* out, size_t len);
+// Marks len bytes of the reserved space as written
+void output_commit(struct output* out, size_t len);
+int output_write(struct output* out, size_t len, const void* data);
+int output_flush(struct output* out);
+// Flushes the output, and waits until everything written so far is on disk
+int output_sync(struct output* out);
+int output_close(struct output* out);
+
+// Number of bytes output_convert writes per sample
+size_t output_sample_size(enum output_format format);
+// Difference between two consecutive values of the output format in mix units, 0 for float formats
+int64_t output_quantum(enum output_format format);
+/*
+ * Converts mixed samples, where 0x8000 is the amplitude of a single voice, to the output format.
+ * Full scale is 2^31, the integer formats are rounded to their resolution and clipped, the float formats are
+ * scaled to 1. Nothing is scaled for int16, where a single voice is half a step, main warns when it is picked
+ * without --gain or --normalize.
+ */
+void output_convert(enum output_format format, size_t n, const int64_t mix[n], void* out);
+
+// Writes everything, retrying on partial writes and EINTR
+int write_all(int fd, size_t len, const void* data);
+
+#endif
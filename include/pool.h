@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+struct pool_slab;
+
+/*
+ * Allocator for many objects of the same size.
+ * Objects are carved out of large slabs, and released ones are kept in a free list,
+ * so pool_alloc and pool_free are O(1), and only call malloc when all slabs are in use.
+ */
+struct pool {
+  size_t item_size;
+  size_t slab_items;       // Minimum number of items of a new slab
+  struct pool_slab* slabs;
+  void* free_list;
+  char* unused;            // Items of the newest slab which were never handed out
+  char* unused_end;
+  size_t capacity;
+  size_t used;
+  size_t high_water;       // Maximum of used so far
+};
+
+void pool_init(struct pool* pool, size_t item_size, size_t slab_items);
+// Makes sure count more items can be allocated without a further malloc
+int pool_reserve(struct pool* pool, size_t count);
+void* pool_alloc(struct pool* pool);
+void pool_free(struct pool* pool, void* item);
+void pool_destroy(struct pool* pool);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <output.h>
+#include <oscillator.h>
+#include <wavetable.h>
+#include <envelope.h>
+#include <stats.h>
+#include <master.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of samples rendered at once
+#define RENDER_BLOCK_SIZE 256
+// Number of voices allocated at once
+#define RENDER_DEFAULT_VOICES 64
+// Number of samples a thread renders at once when rendering in parallel
+#define RENDER_SEGMENT_SIZE (RENDER_BLOCK_SIZE * 64)
+// Voices are only mixed in parallel if there are at least this many active
+#define RENDER_MIX_PARALLEL_MIN 16
+// Number of voices claimed at once by a mixing thread
+#define RENDER_MIX_CHUNK 4
+
+struct render_config {
+  uint32_t samples_per_second;
+  enum output_format format;
+  const struct oscillator* oscillator;
+  enum wavetable_mode wavetable;
+  size_t voices; // Number of voices to allocate up front
+  unsigned mix_threads; // Number of threads mixing the voices of a renderer
+  struct master_config master; // Applied to the mix before it's converted to the output format
+  // Only this window of the timeline is rendered, an end of 0 is the end of the timeline
+  uint64_t begin, end;
+};
+
+// Full amplitude of a voice
+#define VOICE_AMPLITUDE_MAX 0x7FFF
+
+struct voice {
+  uint64_t start;     // in samples
+  uint64_t duration;  // in samples
+  uint64_t gate;      // When the note is released, in samples since the start
+  uint32_t phase;     // At the start. 2^32 is one period
+  uint32_t increment; // per sample
+  enum waveform waveform;
+  const float* table; // In wavetable mode
+  struct envelope envelope;
+  uint16_t amplitude; // Up to VOICE_AMPLITUDE_MAX
+};
+
+/*
+ * All the voices of a track, ordered by their start time.
+ * The state of a voice only depends on the time since it started, so any part of the timeline can be rendered
+ * on its own, and will be the same as if everything before it had been rendered too.
+ */
+struct timeline {
+  size_t count;
+  size_t capacity;
+  struct voice* voice;
+  uint64_t* end_max; // The latest end of the voices up to each one, to find the active voices at any time
+  uint64_t length; // in samples
+  uint64_t end;    // Rendering stops here if nothing more gets added
+};
+
+bool timeline_reserve(struct timeline* timeline, size_t count);
+// The voice must not start before the voices which were already added
+bool timeline_add(struct timeline* timeline, const struct voice* voice);
+/*
+ * Extends the timeline by up to time samples, and returns by how much it was extended.
+ * It is never extended past the point where no voice is left, one sample after the last voice ended.
+ */
+uint64_t timeline_advance(struct timeline* timeline, uint64_t time);
+void timeline_destroy(struct timeline* timeline);
+// The window of the timeline the config renders, clamped to the timeline
+void render_window(const struct render_config* config, const struct timeline* timeline, uint64_t* begin, uint64_t* end);
+
+/*
+ * The active voices, stored as one array per field, so the render loops only touch what they need.
+ * The order of the voices isn't preserved, ended voices are replaced by the last one.
+ */
+struct voices {
+  size_t count;
+  size_t capacity;
+  size_t high_water; // Maximum of count so far
+  uint64_t* time;    // Since the start of the voice
+  uint64_t* duration;
+  uint64_t* gate;
+  uint32_t* phase;
+  uint32_t* increment;
+  uint8_t* waveform;
+  const float** table;
+  struct envelope* envelope;
+  uint16_t* amplitude;
+};
+
+struct mixer;
+struct checkpoint;
+
+struct renderer {
+  const struct render_config* config;
+  const struct timeline* timeline;
+  struct voices voices;
+  struct mixer* mixer; // For mixing the voices in parallel
+  size_t next;   // The next voice of the timeline to start
+  uint64_t time; // The next sample to be rendered
+};
+
+bool renderer_init(struct renderer* renderer, const struct render_config* config, const struct timeline* timeline);
+// Continues rendering at the given time, with exactly the voices which are active at that point
+bool renderer_seek(struct renderer* renderer, uint64_t time);
+// Mixes the next n samples of the timeline
+bool renderer_render(struct renderer* renderer, size_t n, int64_t mix[restrict n]);
+void renderer_destroy(struct renderer* renderer);
+
+/*
+ * Renders the whole timeline to the output, and updates the stats. Without an output, only the stats are computed.
+ * The stats are those of the mix, before the master stage.
+ * With more than one thread, segments of the timeline are rendered in parallel, and written in order.
+ * The result doesn't depend on the number of threads.
+ * With a checkpoint, the render continues where the checkpoint was loaded from, and saves new ones while it goes.
+ */
+int render_timeline(const struct render_config* config, const struct timeline* timeline, struct stats* stats, struct output* output, unsigned threads, struct checkpoint* checkpoint);
+
+#endif
@@ -41,9 +41,18 @@ struct buffer {
   };
 };
 
+// Used if no size is requested, the default is one page
+#define RINGBUFFER_DEFAULT_SIZE 4096
+
+/*
+ * The buffer is mapped twice in a row, so the readable and the writable part are always contiguous.
+ * One thread may read while another one writes, without any locking.
+ */
 struct ringbuffer;
-struct ringbuffer* ringbuffer_create(void);
+// The size is rounded up to a power of 2 which is a multiple of the page size
+struct ringbuffer* ringbuffer_create(unsigned minimum_size);
 void ringbuffer_destroy(struct ringbuffer* rb);
+unsigned ringbuffer_size(const struct ringbuffer* rb);
 
 struct buffer_ro ringbuffer_get_read_buffer(const struct ringbuffer* rb);
 void ringbuffer_discard(struct ringbuffer* rb, int count);
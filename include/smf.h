@@ -0,0 +1,65 @@
+#ifndef SMF_H
+#define SMF_H
+
+#include <midi.h>
+#include <tempo_map.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Standard MIDI Files: an MThd header chunk, followed by one MTrk chunk per track.
+ * Nothing is copied, the tracks and the data of their events point into the file, which must outlive them.
+ */
+#define SMF_HEADER_MAGIC "MThd"
+#define SMF_TRACK_MAGIC "MTrk"
+
+struct smf_track {
+  size_t size;
+  const uint8_t* data;
+  // Decoded by smf_decode, with their time in ticks from the start of the track
+  size_t count;
+  size_t capacity;
+  struct midi_event* event;
+};
+
+struct smf {
+  uint16_t format;   // 0: a single track, 1: tracks played together, 2: independent sequences
+  uint16_t division; // Ticks per quarter note, or if the top bit is set, negated SMPTE frames per second and ticks per frame
+  size_t track_count;
+  struct smf_track* track;
+};
+
+static inline bool smf_is(size_t size, const uint8_t data[size]){
+  return size >= 4 && !memcmp(data, SMF_HEADER_MAGIC, 4);
+}
+
+// Finds the tracks in the file, chunks of other types are skipped
+int smf_parse(struct smf* smf, size_t size, const uint8_t data[size]);
+// Decodes the events of each track up to its end, the tracks are independent, so several threads decode them
+int smf_decode(struct smf* smf, unsigned threads);
+// Builds the tempo map from the tempo changes of all decoded tracks
+bool smf_tempo_map(const struct smf* smf, struct tempo_map* map);
+void smf_destroy(struct smf* smf);
+
+/*
+ * Merges the events of all tracks in the order of their time, using a heap with the next event of each track.
+ * Events at the same time are ordered by track, so the tempo track of a format 1 file comes first.
+ */
+struct smf_merge {
+  const struct smf* smf;
+  size_t count;
+  struct smf_merge_entry {
+    uint64_t time;
+    size_t track;
+    size_t index;
+  }* heap;
+};
+
+bool smf_merge_init(struct smf_merge* merge, const struct smf* smf);
+// Returns 0 once all events were returned
+const struct midi_event* smf_merge_next(struct smf_merge* merge);
+void smf_merge_destroy(struct smf_merge* merge);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Taps of the interpolation filter per oversampled position, and the oversampling factor
+#define STATS_TRUE_PEAK_TAPS 12
+#define STATS_TRUE_PEAK_OVERSAMPLING 4
+// Samples the true peak is computed for at once
+#define STATS_TRUE_PEAK_CHUNK 1024
+// Default length of the windows the peak is tracked for, in milliseconds
+#define STATS_DEFAULT_WINDOW_MS 100
+
+__extension__ typedef unsigned __int128 stats_uint128_t;
+
+/*
+ * Statistics of the mixed samples.
+ * The sums are integers, so they are exact, and don't depend on how the samples are split into blocks.
+ * The true peak is the peak of the signal oversampled 4 times using a windowed sinc interpolation.
+ */
+struct stats {
+  int64_t min;
+  int64_t max;
+  uint64_t peak; // Largest absolute value
+  uint64_t samples_total;
+  stats_uint128_t abs_sum, square_sum;
+  size_t voices_max;
+  double true_peak;
+  // Peak of every window of window_size samples, the last one may be shorter
+  uint64_t window_size; // 0 if the peaks of the windows aren't needed
+  uint64_t window_fill;
+  size_t window_count, window_capacity;
+  uint64_t* window_peak;
+  // Interpolation state
+  double history[STATS_TRUE_PEAK_TAPS-1];
+  double coefficient[STATS_TRUE_PEAK_OVERSAMPLING-1][STATS_TRUE_PEAK_TAPS];
+  double coefficient_bound; // No interpolated value exceeds the neighbouring samples by more than this factor
+};
+
+void stats_init(struct stats* stats, uint64_t window_size);
+bool stats_update(struct stats* stats, size_t n, const int64_t mix[n]);
+// Takes the end of the signal into account, call once after the last update
+bool stats_finish(struct stats* stats);
+void stats_destroy(struct stats* stats);
+
+#endif
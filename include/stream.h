@@ -0,0 +1,25 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <render.h>
+#include <stdint.h>
+
+// How far the output may run ahead of the playback, by default
+#define STREAM_DEFAULT_LATENCY_MS 100
+
+struct stream_report {
+  unsigned underruns;
+  uint64_t underrun_samples; // Time the playback had to wait for the renderer, in samples
+};
+
+/*
+ * Plays the timeline in real time.
+ * A thread renders the timeline into a ring buffer, while the calling thread writes it to fd at the sample rate,
+ * never more than the latency ahead of the playback. Playback starts as soon as the latency is buffered.
+ * If the playback catches up with the renderer, that's an underrun. It gets reported, and once the latency
+ * is buffered again, the playback continues from where it stopped. The data written is always the same
+ * as the one render_timeline would write.
+ */
+int render_stream(const struct render_config* config, const struct timeline* timeline, struct stats* stats, int fd, unsigned latency_ms, struct stream_report* report);
+
+#endif
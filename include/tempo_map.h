@@ -0,0 +1,44 @@
+#ifndef TEMPO_MAP_H
+#define TEMPO_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Microseconds per quarter note until the first tempo change, 120 BPM
+#define TEMPO_MAP_DEFAULT_TEMPO 500000
+
+/*
+ * Converts the ticks of MIDI events to time, following the tempo changes.
+ * The times are exact integers, in units of 1/units_per_second seconds, which depend on the division of the file.
+ * Each segment starts at a tempo change, with the time at its start computed once, so converting a tick only needs
+ * finding its segment.
+ */
+struct tempo_map {
+  uint16_t division;         // From the header of the file
+  uint64_t units_per_second;
+  size_t count;
+  size_t capacity;
+  struct tempo_segment {
+    uint64_t tick;
+    uint64_t time;
+    uint64_t units_per_tick;
+  }* segment;
+  size_t cursor;             // Segment of the last tick converted by tempo_map_next
+};
+
+bool tempo_map_init(struct tempo_map* map, uint16_t division);
+/*
+ * Changes the tempo to microseconds per quarter note from tick on. The changes must be added in the order of their
+ * ticks. Files with SMPTE divisions ignore the tempo.
+ */
+bool tempo_map_add(struct tempo_map* map, uint64_t tick, uint32_t tempo);
+// The time of tick, by a binary search of the segments
+uint64_t tempo_map_time(const struct tempo_map* map, uint64_t tick);
+// The same, but starting from the segment of the previous tick, which makes it O(1) for increasing ticks
+uint64_t tempo_map_next(struct tempo_map* map, uint64_t tick);
+// Converts a time of the map to units of 1/rate seconds, rounded to the nearest
+uint64_t tempo_map_scale(const struct tempo_map* map, uint64_t time, uint64_t rate);
+void tempo_map_destroy(struct tempo_map* map);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TIMELINE_FILE_H
+#define TIMELINE_FILE_H
+
+#include <render.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compiled tracks: the timeline of a track, stored so it can be mapped and rendered without parsing the track again.
+ * The file is a header followed by one record per voice, in the byte order of the machine which wrote it.
+ * A file written by another version, for another sample rate, from another source, or on a machine with another
+ * byte order, is stale, and has to be compiled again.
+ */
+#define TIMELINE_FILE_MAGIC "DPATRKTL"
+#define TIMELINE_FILE_VERSION 4
+#define TIMELINE_FILE_BYTE_ORDER 0x01020304u
+
+struct timeline_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t samples_per_second;
+  uint32_t reserved;
+  uint64_t source_hash;
+  uint64_t count;  // Number of voices
+  uint64_t length; // in samples
+  uint64_t end;
+};
+
+struct timeline_file_voice {
+  uint64_t start;
+  uint64_t duration;
+  uint64_t gate;
+  uint32_t phase;
+  uint32_t increment;
+  uint32_t attack, decay, release;
+  uint16_t sustain;
+  uint8_t waveform;
+  uint8_t envelope;
+  uint16_t amplitude;
+  uint16_t reserved[3];
+};
+
+// FNV-1a hash of the source of a timeline
+uint64_t timeline_source_hash(size_t size, const void* data);
+
+// Writes the timeline to path, replacing the file only once it's complete
+int timeline_save(const char* path, const struct timeline* timeline, uint32_t samples_per_second, uint64_t source_hash);
+
+/*
+ * Reads a timeline written by timeline_save. The wavetables of the voices are looked up if the config uses them.
+ * If source_hash isn't 0, the file must have been compiled from a source with that hash.
+ * Returns 0 on success, 1 if the file is missing or stale, and -1 on other errors.
+ */
+int timeline_load(const char* path, struct timeline* timeline, const struct render_config* config, uint64_t source_hash);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// A slice of the input, not terminated
+struct token {
+  const char* data;
+  size_t length;
+};
+
+static inline bool token_is(struct token token, const char* s){
+  const size_t length = strlen(s);
+  return token.length == length && !memcmp(token.data, s, length);
+}
+
+// The whole input, mapped if it is a regular file, otherwise read into memory
+struct source {
+  const char* data;
+  size_t size;
+  bool mapped;
+};
+
+int source_open(struct source* source, int fd);
+void source_close(struct source* source);
+
+/*
+ * Splits the input into lines, and the lines into tokens separated by spaces, tabs and carriage returns.
+ * Nothing is copied, the tokens point into the input.
+ */
+struct tokenizer {
+  const char* next;     // Start of the next line
+  const char* position; // In the current line
+  const char* line_end;
+  const char* end;
+};
+
+void tokenizer_init(struct tokenizer* tokenizer, size_t size, const char data[size]);
+// Moves to the next line, returns false at the end of the input
+bool tokenizer_next_line(struct tokenizer* tokenizer);
+// Returns false at the end of the line
+bool tokenizer_next(struct tokenizer* tokenizer, struct token* token);
+
+/*
+ * Parses a decimal number at the start of the token, like strtold, and removes it from the token.
+ * Returns false if there is no number.
+ */
+bool token_parse_number(struct token* token, long double* value);
+// Parses a token which is a whole decimal integer
+bool token_to_long(struct token token, long* value);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#include <oscillator.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples per period, must be a power of 2
+#define WAVETABLE_SIZE_LOG2 11
+#define WAVETABLE_SIZE (1u << WAVETABLE_SIZE_LOG2)
+// Level l contains the harmonics up to WAVETABLE_SIZE/4 >> l
+#define WAVETABLE_LEVELS (WAVETABLE_SIZE_LOG2 - 1)
+
+#define WAVETABLE_MODES \
+  X(WAVETABLE_OFF, "off") \
+  X(WAVETABLE_LINEAR, "linear") \
+  X(WAVETABLE_CUBIC, "cubic")
+
+enum wavetable_mode {
+#define X(N, S) N,
+  WAVETABLE_MODES
+#undef X
+  WAVETABLE_MODE_COUNT
+};
+
+extern const char*const wavetable_mode_name[WAVETABLE_MODE_COUNT];
+
+/*
+ * Returns the table of the waveform which is band-limited for the given phase increment,
+ * so that no harmonic is above the nyquist frequency. The tables of a waveform are computed on first use.
+ * The table has one guard sample before and two after the period, for the interpolation.
+ * Returns 0 if the tables couldn't be allocated.
+ */
+const float* wavetable_get(enum waveform waveform, uint32_t increment);
+
+// Same as an oscillator_kernel_t, but reads the samples from a table returned by wavetable_get
+void wavetable_render(enum wavetable_mode mode, const float* table, size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Preloaded by bin/bench to count the allocations of the program being benchmarked.
+ * The count is written to the file descriptor in ALLOCCOUNT_FD when the program exits.
+ */
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// glibc exports its allocator under these names too
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static _Atomic unsigned long long allocations;
+
+void* malloc(size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void alloccount_report(void){
+  const char* fd = getenv("ALLOCCOUNT_FD");
+  if(!fd)
+    return;
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%llu\n", atomic_load(&allocations));
+  if(n > 0 && write(atoi(fd), buf, n) != n)
+    return;
+}
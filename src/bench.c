@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#define DEFAULT_EXAMPLE "examples/Rondo Alla Turca.trk"
+
+static const char*const note_name[] = {"c", "c#", "d", "d#", "e", "f", "f#", "g", "g#", "a", "a#", "h"};
+
+// Chords of the given number of voices, one per second
+static void generate_chords(FILE* f, unsigned voices){
+  fprintf(f, ":tempo 1s\n");
+  for(unsigned chord=0; chord<30; chord++){
+    for(unsigned i=0; i<voices; i++)
+      fprintf(f, "n %s %u 1\n", note_name[(chord * 5 + i * 7) % 12], 2 + (chord + i) % 5);
+    fprintf(f, ">> 1\n");
+  }
+}
+
+// A few notes which play for a long time
+static void generate_sustained(FILE* f){
+  fprintf(f, ":tempo 1s\n");
+  for(unsigned i=0; i<4; i++)
+    fprintf(f, "n %s %u 60\n", note_name[i * 4 % 12], 3 + i % 2);
+  fprintf(f, ">>\n");
+}
+
+// Thousands of 1/32 notes, one after the other
+static void generate_short(FILE* f){
+  fprintf(f, ":tempo 1s\n");
+  for(unsigned i=0; i<10000; i++)
+    fprintf(f, "n %s %u 1/32 >> 1/32\n", note_name[i * 5 % 12], 3 + i / 12 % 3);
+}
+
+// Melody with the tempo changing every bar
+static void generate_tempo(FILE* f){
+  for(unsigned bar=0; bar<200; bar++){
+    fprintf(f, ":tempo %ums\n", 400 + bar * 37 % 800);
+    for(unsigned i=0; i<4; i++)
+      fprintf(f, "n %s 4 1/4\nn %s 3 1/2 >> 1/4\n", note_name[(bar + i * 2) % 12], note_name[(bar + 7) % 12]);
+  }
+}
+
+struct benchmark {
+  const char* name;
+  char path[4096];
+};
+
+struct result {
+  uint64_t samples;
+  uint32_t samples_per_second;
+  double seconds;
+  long peak_rss; // KiB
+  unsigned long long allocations;
+};
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads the sample rate from the wav header, and counts the samples after the start of the data chunk
+static bool wav_info(int fd, uint64_t* samples, uint32_t* samples_per_second){
+  struct stat st;
+  unsigned char h[12];
+  if(fstat(fd, &st) == -1 || pread(fd, h, sizeof(h), 0) != sizeof(h) || memcmp(h, "RIFF", 4) || memcmp(h+8, "WAVE", 4))
+    return false;
+  uint32_t block_align = 0;
+  for(off_t offset=12; offset+8<=st.st_size; ){
+    unsigned char c[24];
+    if(pread(fd, c, 8, offset) != 8)
+      return false;
+    const uint32_t size = c[4] | c[5] << 8 | c[6] << 16 | (uint32_t)c[7] << 24;
+    if(!memcmp(c, "fmt ", 4)){
+      if(pread(fd, c+8, 16, offset+8) != 16)
+        return false;
+      *samples_per_second = c[12] | c[13] << 8 | c[14] << 16 | (uint32_t)c[15] << 24;
+      block_align = c[20] | c[21] << 8;
+    }else if(!memcmp(c, "data", 4)){
+      if(!block_align)
+        return false;
+      // The size in the header may be a placeholder
+      *samples = (st.st_size - offset - 8) / block_align;
+      return true;
+    }
+    offset += 8 + size + (size & 1);
+  }
+  return false;
+}
+
+static bool run(char* argv[], const char* input, const char* output, const char* preload, struct result* result){
+  int allocfd[2] = {-1, -1};
+  if(preload && pipe(allocfd) == -1){
+    fprintf(stderr, "%s:%u: pipe failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  const double start = now();
+  const pid_t pid = fork();
+  if(pid == -1){
+    fprintf(stderr, "%s:%u: fork failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  if(!pid){
+    const int in = open(input, O_RDONLY);
+    const int out = open(output, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(in == -1 || out == -1 || dup2(in, 0) == -1 || dup2(out, 1) == -1)
+      _exit(127);
+    if(preload){
+      char fd[16];
+      snprintf(fd, sizeof(fd), "%d", allocfd[1]);
+      close(allocfd[0]);
+      setenv("ALLOCCOUNT_FD", fd, 1);
+      setenv("LD_PRELOAD", preload, 1);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  if(preload)
+    close(allocfd[1]);
+  int status;
+  struct rusage usage;
+  while(wait4(pid, &status, 0, &usage) == -1){
+    if(errno == EINTR)
+      continue;
+    fprintf(stderr, "%s:%u: wait4 failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  result->seconds = now() - start;
+  result->peak_rss = usage.ru_maxrss;
+  result->allocations = 0;
+  if(preload){
+    char buf[32] = {0};
+    if(read(allocfd[0], buf, sizeof(buf)-1) > 0)
+      result->allocations = strtoull(buf, 0, 10);
+    close(allocfd[0]);
+  }
+  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+    fprintf(stderr, "%s failed on %s\n", argv[0], input);
+    return false;
+  }
+  const int fd = open(output, O_RDONLY);
+  const bool ok = fd != -1 && wav_info(fd, &result->samples, &result->samples_per_second);
+  if(fd != -1)
+    close(fd);
+  if(!ok)
+    fprintf(stderr, "%s: not a wav file\n", output);
+  return ok;
+}
+
+static void usage(const char* name){
+  fprintf(stderr,
+    "Usage: %s [options] [-- main options] >results.jsonl\n"
+    "Renders synthetic tracks and the example track, and prints one JSON object per track.\n"
+    "Options:\n"
+    "  -m, --main PATH      The program to benchmark, default bin/main\n"
+    "  -p, --preload PATH   Library counting the allocations, default bin/alloccount.so\n"
+    "  -e, --example PATH   Track to benchmark besides the synthetic ones, default \"" DEFAULT_EXAMPLE "\"\n"
+    "  -r, --repeat COUNT   Run every track COUNT times, and take the fastest run. Default: 3\n"
+    "  -h, --help           Show this help\n",
+    name
+  );
+}
+
+int main(int argc, char* argv[]){
+  const char* main_path = "bin/main";
+  const char* preload = "bin/alloccount.so";
+  const char* example = DEFAULT_EXAMPLE;
+  unsigned repeat = 3;
+  static const struct option long_options[] = {
+    {"main",    required_argument, 0, 'm'},
+    {"preload", required_argument, 0, 'p'},
+    {"example", required_argument, 0, 'e'},
+    {"repeat",  required_argument, 0, 'r'},
+    {"help",    no_argument,       0, 'h'},
+    {0}
+  };
+  for(int c; (c = getopt_long(argc, argv, "m:p:e:r:h", long_options, 0)) != -1;){
+    switch(c){
+      case 'm': main_path = optarg; break;
+      case 'p': preload = *optarg ? optarg : 0; break;
+      case 'e': example = optarg; break;
+      case 'r': {
+        char* end = 0;
+        repeat = strtoul(optarg, &end, 0);
+        if(end == optarg || *end || !repeat){
+          fprintf(stderr, "invalid repeat count: %s\n", optarg);
+          return 1;
+        }
+      } break;
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if(preload && access(preload, R_OK)){
+    fprintf(stderr, "%s not found, not counting allocations\n", preload);
+    preload = 0;
+  }
+  // LD_PRELOAD needs a path containing a slash, or it searches the library path
+  char preload_path[4096];
+  if(preload && !realpath(preload, preload_path)){
+    fprintf(stderr, "%s:%u: realpath failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return 1;
+  }
+
+  // The remaining arguments are passed on to the benchmarked program
+  char** child_argv = calloc(argc - optind + 2, sizeof(*child_argv));
+  if(!child_argv){
+    fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return 1;
+  }
+  child_argv[0] = (char*)main_path;
+  for(int i=optind; i<argc; i++)
+    child_argv[i-optind+1] = argv[i];
+
+  char dir[] = "/tmp/bench.XXXXXX";
+  if(!mkdtemp(dir)){
+    fprintf(stderr, "%s:%u: mkdtemp failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return 1;
+  }
+  struct benchmark benchmark[] = {
+    {.name = "chord-16"}, {.name = "chord-64"}, {.name = "sustained"},
+    {.name = "short-notes"}, {.name = "tempo-changes"}, {.name = "example"},
+  };
+  enum { BENCHMARK_COUNT = sizeof(benchmark) / sizeof(*benchmark) };
+  int ret = 1;
+  for(size_t i=0; i<BENCHMARK_COUNT-1; i++){
+    snprintf(benchmark[i].path, sizeof(benchmark[i].path), "%s/%s.trk", dir, benchmark[i].name);
+    FILE* f = fopen(benchmark[i].path, "w");
+    if(!f){
+      fprintf(stderr, "%s:%u: fopen failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      goto out;
+    }
+    switch(i){
+      case 0: generate_chords(f, 16); break;
+      case 1: generate_chords(f, 64); break;
+      case 2: generate_sustained(f); break;
+      case 3: generate_short(f); break;
+      case 4: generate_tempo(f); break;
+    }
+    if(fclose(f)){
+      fprintf(stderr, "%s:%u: fclose failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      goto out;
+    }
+  }
+  snprintf(benchmark[BENCHMARK_COUNT-1].path, sizeof(benchmark[BENCHMARK_COUNT-1].path), "%s", example);
+
+  char output[4096];
+  snprintf(output, sizeof(output), "%s/output.wav", dir);
+  const time_t timestamp = time(0);
+  for(size_t i=0; i<BENCHMARK_COUNT; i++){
+    struct result best = {0};
+    for(unsigned j=0; j<repeat; j++){
+      struct result result;
+      if(!run(child_argv, benchmark[i].path, output, preload ? preload_path : 0, &result))
+        goto out;
+      if(!j || best.seconds > result.seconds)
+        best = result;
+    }
+    const double audio_seconds = (double)best.samples / best.samples_per_second;
+    printf(
+      "{\"timestamp\": %lld, \"track\": \"%s\", \"samples\": %llu, \"seconds\": %.6f, \"samples_per_second\": %.0f,"
+      " \"realtime_factor\": %.2f, \"peak_rss_kib\": %ld, \"allocations\": %llu, \"allocations_per_second\": %.1f}\n",
+      (long long)timestamp, benchmark[i].name, (unsigned long long)best.samples, best.seconds, best.samples / best.seconds,
+      audio_seconds / best.seconds, best.peak_rss, best.allocations, best.allocations / best.seconds
+    );
+    fflush(stdout);
+    fprintf(stderr, "%-14s %10.0f samples/s %8.2fx real time %8ld KiB peak RSS %10llu allocations\n",
+      benchmark[i].name, best.samples / best.seconds, audio_seconds / best.seconds, best.peak_rss, best.allocations);
+  }
+  ret = 0;
+out:
+  unlink(output);
+  for(size_t i=0; i<BENCHMARK_COUNT-1; i++)
+    if(*benchmark[i].path)
+      unlink(benchmark[i].path);
+  rmdir(dir);
+  free(child_argv);
+  return ret;
+}
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <checkpoint.h>
+#include <output.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+// FNV-1a, continuing from hash
+static uint64_t hash_add(uint64_t hash, size_t size, const void* data){
+  const unsigned char* p = data;
+  for(size_t i=0; i<size; i++){
+    hash ^= p[i];
+    hash *= 0x100000001B3;
+  }
+  return hash;
+}
+
+#define HASH_ADD(hash, value) hash_add(hash, sizeof(value), &(value))
+
+uint64_t checkpoint_identity(const struct render_config* config, const struct timeline* t){
+  uint64_t hash = 0xCBF29CE484222325;
+  const uint32_t format = config->format, wavetable = config->wavetable;
+  const uint8_t dither = config->master.dither;
+  hash = HASH_ADD(hash, config->samples_per_second);
+  hash = HASH_ADD(hash, format);
+  hash = hash_add(hash, strlen(config->oscillator->name), config->oscillator->name);
+  hash = HASH_ADD(hash, wavetable);
+  hash = HASH_ADD(hash, config->master.gain);
+  hash = HASH_ADD(hash, config->master.ceiling);
+  hash = HASH_ADD(hash, config->master.lookahead);
+  hash = HASH_ADD(hash, config->master.release);
+  hash = HASH_ADD(hash, dither);
+  hash = HASH_ADD(hash, t->length);
+  uint64_t begin, end;
+  render_window(config, t, &begin, &end);
+  hash = HASH_ADD(hash, begin);
+  hash = HASH_ADD(hash, end);
+  for(size_t i=0; i<t->count; i++){
+    const struct voice*const v = &t->voice[i];
+    const uint8_t waveform = v->waveform;
+    hash = HASH_ADD(hash, v->start);
+    hash = HASH_ADD(hash, v->duration);
+    hash = HASH_ADD(hash, v->gate);
+    hash = HASH_ADD(hash, v->phase);
+    hash = HASH_ADD(hash, v->increment);
+    hash = HASH_ADD(hash, waveform);
+    hash = HASH_ADD(hash, v->envelope.type);
+    hash = HASH_ADD(hash, v->envelope.sustain);
+    hash = HASH_ADD(hash, v->envelope.attack);
+    hash = HASH_ADD(hash, v->envelope.decay);
+    hash = HASH_ADD(hash, v->envelope.release);
+    hash = HASH_ADD(hash, v->amplitude);
+  }
+  return hash;
+}
+
+static int read_all(int fd, size_t len, void* data){
+  while(len){
+    ssize_t s = read(fd, data, len);
+    if(s == -1 && errno == EINTR)
+      continue;
+    if(s == -1){
+      fprintf(stderr, "%s:%u: read failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return -1;
+    }
+    if(!s)
+      return 1;
+    data = (char*)data + s;
+    len -= s;
+  }
+  return 0;
+}
+
+int checkpoint_load(struct checkpoint* c, const struct render_config* config, struct stats* stats){
+  const int fd = open(c->path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1){
+    if(errno == ENOENT)
+      return 1;
+    fprintf(stderr, "%s:%u: open failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  int ret = 1;
+  struct checkpoint_file_header header;
+  int r = read_all(fd, sizeof(header), &header);
+  if(r){
+    ret = r;
+    goto out;
+  }
+  if( memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))
+   || header.version != CHECKPOINT_VERSION
+   || header.byte_order != CHECKPOINT_BYTE_ORDER
+   || header.identity != c->identity
+  ) goto out;
+  c->has_master = master_enabled(&config->master, config->format);
+  if(c->has_master){
+    struct master*const m = &c->master;
+    if(!master_init(m, &config->master, config->format)){
+      c->has_master = false;
+      ret = -1;
+      goto out;
+    }
+    if(header.size != (m->delay ? m->size : 0) || header.minimum_count > header.size || header.minimum_first >= m->size){
+      checkpoint_destroy(c);
+      goto out;
+    }
+    m->length = header.master_length;
+    m->in = header.master_in;
+    m->out = header.master_out;
+    m->hold_sum = header.hold_sum;
+    m->held = header.held;
+    m->minimum_first = header.minimum_first;
+    m->minimum_count = header.minimum_count;
+    if(m->delay){
+      if( (r = read_all(fd, sizeof(*m->delay) * m->size, m->delay))
+       || (r = read_all(fd, sizeof(*m->hold) * m->size, m->hold))
+       || (r = read_all(fd, sizeof(*m->minimum) * m->size, m->minimum))
+      ){
+        checkpoint_destroy(c);
+        ret = r;
+        goto out;
+      }
+    }
+  }
+  stats->min = header.min;
+  stats->max = header.max;
+  stats->peak = header.peak;
+  stats->samples_total = header.samples_total;
+  stats->abs_sum = (stats_uint128_t)header.abs_sum[1] << 64 | header.abs_sum[0];
+  stats->square_sum = (stats_uint128_t)header.square_sum[1] << 64 | header.square_sum[0];
+  stats->voices_max = header.voices_max;
+  stats->true_peak = header.true_peak;
+  memcpy(stats->history, header.history, sizeof(stats->history));
+  c->time = header.time;
+  c->written = header.written;
+  ret = 0;
+out:
+  close(fd);
+  return ret;
+}
+
+int checkpoint_save(const struct checkpoint* c, uint64_t time, uint64_t written, const struct stats* stats, const struct master* m){
+  char tmp[4096];
+  if((size_t)snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", c->path, (long)getpid()) >= sizeof(tmp)){
+    fprintf(stderr, "%s:%u: path too long: %s\n", __FILE__, __LINE__, c->path);
+    return -1;
+  }
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd == -1){
+    fprintf(stderr, "%s:%u: open failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  struct checkpoint_file_header header = {
+    .magic = CHECKPOINT_MAGIC,
+    .version = CHECKPOINT_VERSION,
+    .byte_order = CHECKPOINT_BYTE_ORDER,
+    .identity = c->identity,
+    .time = time,
+    .written = written,
+    .min = stats->min,
+    .max = stats->max,
+    .peak = stats->peak,
+    .samples_total = stats->samples_total,
+    .abs_sum = {stats->abs_sum, stats->abs_sum >> 64},
+    .square_sum = {stats->square_sum, stats->square_sum >> 64},
+    .voices_max = stats->voices_max,
+    .true_peak = stats->true_peak,
+  };
+  memcpy(header.history, stats->history, sizeof(header.history));
+  if(m){
+    header.master_length = m->length;
+    header.master_in = m->in;
+    header.master_out = m->out;
+    header.hold_sum = m->hold_sum;
+    header.held = m->held;
+    header.size = m->delay ? m->size : 0;
+    header.minimum_first = m->minimum_first;
+    header.minimum_count = m->minimum_count;
+  }
+  if(write_all(fd, sizeof(header), &header))
+    goto error;
+  if( m && m->delay
+   && ( write_all(fd, sizeof(*m->delay) * m->size, m->delay)
+     || write_all(fd, sizeof(*m->hold) * m->size, m->hold)
+     || write_all(fd, sizeof(*m->minimum) * m->size, m->minimum)
+  )) goto error;
+  // The checkpoint must not replace the last one before it's on disk
+  if(fdatasync(fd) == -1){
+    fprintf(stderr, "%s:%u: fdatasync failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    goto error;
+  }
+  if(close(fd) == -1){
+    fprintf(stderr, "%s:%u: close failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  if(rename(tmp, c->path) == -1){
+    fprintf(stderr, "%s:%u: rename failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+error:
+  close(fd);
+  unlink(tmp);
+  return -1;
+}
+
+int checkpoint_remove(const struct checkpoint* c){
+  if(unlink(c->path) == -1 && errno != ENOENT){
+    fprintf(stderr, "%s:%u: unlink failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void checkpoint_destroy(struct checkpoint* c){
+  if(c->has_master)
+    master_destroy(&c->master);
+  c->has_master = false;
+}
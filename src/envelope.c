@@ -0,0 +1,60 @@
+#include <envelope.h>
+
+const char*const envelope_type_name[ENVELOPE_TYPE_COUNT] = {
+#define X(N, S) [N] = S,
+  ENVELOPE_TYPES
+#undef X
+};
+
+// Linear ramp from a to b, over length samples
+static int32_t ramp(int32_t a, int32_t b, uint64_t time, uint64_t length){
+  if(time >= length)
+    return b;
+  return a + (int64_t)(b - a) * (int64_t)time / (int64_t)length;
+}
+
+static int32_t adsr_held(const struct envelope* e, uint64_t time){
+  if(time < e->attack)
+    return ramp(0, ENVELOPE_MAX, time, e->attack);
+  return ramp(ENVELOPE_MAX, e->sustain, time - e->attack, e->decay);
+}
+
+int32_t envelope_value(const struct envelope* e, uint64_t gate, uint64_t time){
+  switch((enum envelope_type)e->type){
+    case ENVELOPE_DECAY: {
+      // Divides once per ENVELOPE_STEP samples, like ramp, a hyperbola has no reciprocal to precompute
+      const long double h = e->decay;
+      return h / (time + h) * ENVELOPE_MAX;
+    }
+    case ENVELOPE_ADSR: {
+      if(time < gate)
+        return adsr_held(e, time);
+      return ramp(adsr_held(e, gate), 0, time - gate, e->release);
+    }
+    case ENVELOPE_TYPE_COUNT: break;
+  }
+  return ENVELOPE_MAX;
+}
+
+void envelope_render(const struct envelope* e, uint64_t gate, uint64_t time, size_t n, int32_t gain[restrict n]){
+  // Start at the step containing time
+  uint64_t step = time & ~(uint64_t)(ENVELOPE_STEP - 1);
+  size_t offset = time - step;
+  int32_t a = envelope_value(e, gate, step);
+  for(size_t i=0; i<n; ){
+    const int32_t b = envelope_value(e, gate, step + ENVELOPE_STEP);
+    const int32_t delta = b - a;
+    size_t count = ENVELOPE_STEP - offset;
+    if(count > n - i)
+      count = n - i;
+    // a + delta * j / ENVELOPE_STEP, incrementally. The division rounds toward 0, also for falling gains, so it is a
+    // shift with a sign correction rather than a plain shift
+    int32_t acc = delta * (int32_t)offset;
+    for(size_t j=0; j<count; j++, acc+=delta)
+      gain[i+j] = a + acc / (int32_t)ENVELOPE_STEP;
+    i += count;
+    offset = 0;
+    step += ENVELOPE_STEP;
+    a = b;
+  }
+}
@@ -1,3 +1,15 @@
+#define _GNU_SOURCE
+#include <output.h>
+#include <oscillator.h>
+#include <wavetable.h>
+#include <render.h>
+#include <envelope.h>
+#include <stream.h>
+#include <timeline_file.h>
+#include <tokenizer.h>
+#include <checkpoint.h>
+#include <smf.h>
+#include <midi_notes.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -5,29 +17,33 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <getopt.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <attr/xattr.h>
 
 #define COMMON_SAMPLE_RATE_44_1 44100
 #define COMMON_SAMPLE_RATE_48   48000
+#define SAMPLE_RATE_MIN 8000
+#define SAMPLE_RATE_MAX 384000
 
-#ifndef M_PIl
-#define M_PIl 3.141592653589793238462643383279502884L
-#endif
 #define C_2_POW_1_12 1.0594630943592952645618252949463417007792043174941856285592084314L
 
-enum output_format {
-  F_FLOAT_64,
-  F_FLOAT_32,
-  F_INT_32,
-};
+// Half time of the default envelope, in seconds
+#define SETTINGS_DEFAULT_DECAY 0.1L
 
 struct settings {
   long double c4;
   long double tempo;
   long double speed;
   const struct intonation* intonation;
+  enum waveform waveform;
+  // The envelope of the notes, the times are in seconds
+  enum envelope_type envelope;
+  long double attack, decay, sustain, release;
 };
 
 struct note {
@@ -114,105 +130,166 @@ const struct intonation intonation[] = {
 };
 enum { INTONATION_COUNT = sizeof(intonation) / sizeof(*intonation) };
 
-typedef int16_t sample_generator_t(long double f);
-extern sample_generator_t sg_sin;
+/*
+ * The length of the track is known before it's rendered, so the header has the real sizes.
+ * Files too large for the 32 bit sizes of RIFF are written as RF64, with the sizes in a ds64 chunk.
+ */
+#define WAV_HEADER_SIZE 44
+#define RF64_HEADER_SIZE (WAV_HEADER_SIZE + 36)
 
-struct wav_header { unsigned char data[44]; };
-struct wav_header mk_wav(uint32_t channels, uint16_t sample_rate, enum output_format format){
-  const uint16_t bits_per_sample = format == F_FLOAT_64 ? 64 : 32;
-  const uint64_t sbcb = ((int64_t)sample_rate * bits_per_sample * channels + 7) / 8;
-  const uint64_t bcb = ((int64_t)bits_per_sample * channels + 7) / 8;
-  const bool isfloat = format != F_INT_32;
-  struct wav_header h = {{
-    'R','I','F','F',
-     ~0, ~0, ~0, ~0, // file size
-    'W','A','V','E',
-    'f','m','t',' ',
-     16,  0,  0,  0,
-    isfloat?3:1,  0,
-    channels, channels>>8,
-    sample_rate, sample_rate>>8, sample_rate>>16, sample_rate>>24,
-    sbcb, sbcb>>8, sbcb>>16, sbcb>>24,
-    bcb, bcb>>8,
-    bits_per_sample, bits_per_sample>>8,
-    'd','a','t','a',
-     ~0, ~0, ~0, ~0, // data size (file size - 44)
-  }};
-  return h;
+struct wav_header { size_t size; unsigned char data[RF64_HEADER_SIZE]; };
+
+unsigned char* put_u16(unsigned char* p, uint16_t v){
+  p[0] = v; p[1] = v >> 8;
+  return p + 2;
 }
 
-long double parse_time(const struct settings*const s, const char*const restrict input);
+unsigned char* put_u32(unsigned char* p, uint32_t v){
+  return put_u16(put_u16(p, v), v >> 16);
+}
 
-int16_t sg_sin(long double f){
-  return sinl(2 * M_PIl * f) * 0x7FFFu;
+unsigned char* put_u64(unsigned char* p, uint64_t v){
+  return put_u32(put_u32(p, v), v >> 32);
 }
 
-int16_t sg_triangle(long double f){
-  int32_t x = (int32_t)0x7FFFl*4 * f;
-  if(x > 0x7FFF)
-    x = -(x-0x7FFF);
-  if(x < 0x7FFF)
-    x = -(x+0x7FFF);
-  return x;
+unsigned char* put_tag(unsigned char* p, const char tag[4]){
+  memcpy(p, tag, 4);
+  return p + 4;
 }
 
-int16_t sg_square(long double f){
-  return f > 0.5 ? 0x7FFF : -0x7FFF;
+struct wav_header mk_wav(uint32_t channels, uint32_t sample_rate, enum output_format format, uint64_t samples){
+  const uint16_t bits_per_sample = output_sample_size(format) * 8;
+  const uint64_t sbcb = ((int64_t)sample_rate * bits_per_sample * channels + 7) / 8;
+  const uint64_t bcb = ((int64_t)bits_per_sample * channels + 7) / 8;
+  const bool isfloat = !output_quantum(format);
+  const uint64_t data_size = samples * bcb;
+  const bool rf64 = data_size > UINT32_MAX - (WAV_HEADER_SIZE - 8);
+  struct wav_header h = { .size = rf64 ? RF64_HEADER_SIZE : WAV_HEADER_SIZE };
+  unsigned char* p = h.data;
+  p = put_tag(p, rf64 ? "RF64" : "RIFF");
+  p = put_u32(p, rf64 ? UINT32_MAX : data_size + h.size - 8); // file size - 8
+  p = put_tag(p, "WAVE");
+  if(rf64){
+    p = put_tag(p, "ds64");
+    p = put_u32(p, 28);
+    p = put_u64(p, data_size + h.size - 8);
+    p = put_u64(p, data_size);
+    p = put_u64(p, samples);
+    p = put_u32(p, 0); // No sizes of other chunks
+  }
+  p = put_tag(p, "fmt ");
+  p = put_u32(p, 16);
+  p = put_u16(p, isfloat ? 3 : 1);
+  p = put_u16(p, channels);
+  p = put_u32(p, sample_rate);
+  p = put_u32(p, sbcb);
+  p = put_u16(p, bcb);
+  p = put_u16(p, bits_per_sample);
+  p = put_tag(p, "data");
+  p = put_u32(p, rf64 ? UINT32_MAX : data_size);
+  return h;
 }
 
+bool try_parse_time(const struct settings*const s, struct token input, long double* time);
+long double parse_time(const struct settings*const s, struct token input);
+
+// Octaves of the pitch table, notes outside of it are computed when needed
+#define PITCH_OCTAVE_MIN (-4)
+#define PITCH_OCTAVE_COUNT 16
+// Note names are a letter from a to h, optionally followed by a #
+#define NOTE_KEY_COUNT (('h' - 'a' + 1) * 2)
+
+struct pitch {
+  uint32_t increment; // Phase increment per sample, 2^32 is one period. 0 if the note can't be played
+};
+
+/*
+ * The phase increment of every note and octave, for one intonation and base pitch.
+ * It is rebuilt when either of them changes.
+ */
+struct pitch_table {
+  const struct intonation* intonation;
+  long double c4;
+  int8_t note[NOTE_KEY_COUNT]; // Index of a note name in the table, -1 if the intonation doesn't have it
+  struct pitch pitch[12][PITCH_OCTAVE_COUNT];
+};
+
 struct tracker {
   struct settings settings;
-  struct {
-    int32_t min;
-    int32_t max;
-    uint64_t samples_total;
-    long double square_sum, abs_sum;
-  } stats;
   unsigned long line;
-  enum output_format format;
-  uint32_t samples_per_second;
-  struct generator* generator_list;
+  struct render_config config;
+  struct timeline timeline;
+  struct pitch_table pitch_table;
 };
 
-struct tone {
-  const struct tracker* tracker;
-  sample_generator_t* waveform;
-  uint32_t duration; // in samples
-  uint32_t phase;    // in samples
-};
+// Returns the index of the note name in pitch_table.note, or -1 if it isn't a note name
+int note_key(struct token name){
+  if(name.length < 1 || name.length > 2 || name.data[0] < 'a' || name.data[0] > 'h')
+    return -1;
+  if(name.length == 2 && name.data[1] != '#')
+    return -1;
+  return (name.data[0] - 'a') * 2 + (name.length == 2);
+}
 
-struct generator {
-  struct generator* next;
-  uint64_t duration;
-  uint64_t time;
-  struct tone tone;
-};
+/*
+ * The increment is rounded from the exact frequency, so the pitch is off by at most half a step of
+ * samples_per_second / 2^32, about 0.00001Hz at 48kHz. Notes at or above the sample rate can't be played.
+ */
+struct pitch pitch_compute(uint32_t samples_per_second, long double c4, long double factor, long octave){
+  const long double frequency = c4 * (powl(2, octave) / 16) * factor;
+  const long double increment = roundl(frequency * 0x100000000 / samples_per_second);
+  if(!(increment >= 1 && increment < 0x100000000))
+    return (struct pitch){0};
+  return (struct pitch){ .increment = increment };
+}
 
-int16_t tone_get_sample(struct tone* tone){
-  uint32_t phase = tone->phase + 1;
-  if(phase >= tone->duration)
-    phase = 0;
-  tone->phase = phase;
-  return tone->waveform((long double)tone->phase / tone->duration);
+void pitch_table_build(struct pitch_table* t, uint32_t samples_per_second, const struct intonation* intonation, long double c4){
+  t->intonation = intonation;
+  t->c4 = c4;
+  memset(t->note, -1, sizeof(t->note));
+  for(size_t i=0; i<intonation->note_count; i++){
+    const struct note*const note = &intonation->note_map[i];
+    t->note[note_key((struct token){ .data = note->name, .length = strlen(note->name) })] = i;
+    for(int octave=0; octave<PITCH_OCTAVE_COUNT; octave++)
+      t->pitch[i][octave] = pitch_compute(samples_per_second, c4, note->factor, PITCH_OCTAVE_MIN + octave);
+  }
 }
 
-long double intonation_get_note_factor(const struct intonation*const intonation, const char* name){
+// Looks up a note of the current intonation and base pitch
+struct pitch tracker_get_pitch(struct tracker* tracker, struct token name, long octave){
+  const struct settings*const s = &tracker->settings;
+  struct pitch_table*const t = &tracker->pitch_table;
+  if(t->intonation != s->intonation || t->c4 != s->c4)
+    pitch_table_build(t, tracker->config.samples_per_second, s->intonation, s->c4);
+  const int key = note_key(name);
+  const int note = key < 0 ? -1 : t->note[key];
+  if(note < 0)
+    return (struct pitch){0};
+  if(octave >= PITCH_OCTAVE_MIN && octave < PITCH_OCTAVE_MIN + PITCH_OCTAVE_COUNT)
+    return t->pitch[note][octave - PITCH_OCTAVE_MIN];
+  return pitch_compute(tracker->config.samples_per_second, s->c4, s->intonation->note_map[note].factor, octave);
+}
+
+long double intonation_get_note_factor(const struct intonation*const intonation, struct token name){
   for(size_t i=0; i<intonation->note_count; i++)
-    if(!strcmp(name, intonation->note_map[i].name))
+    if(token_is(name, intonation->note_map[i].name))
       return intonation->note_map[i].factor;
   return 0;
 }
 
-void state_set(struct settings* s, int argc, char* argv[argc]){
+void state_set(struct settings* s, int argc, const struct token argv[argc]){
   if(argc < 1)
     return;
-  if(!strcmp(argv[0], "speed")){
+  if(token_is(argv[0], "speed")){
     if(argc != 2)
       return;
-    s->speed = strtold(argv[1], 0);
+    struct token speed = argv[1];
+    long double value;
+    if(token_parse_number(&speed, &value) && !speed.length)
+      s->speed = value;
     return;
   }
-  if(!strcmp(argv[0], "tempo")){
+  if(token_is(argv[0], "tempo")){
     if(argc != 2)
       return;
     long double o = s->tempo;
@@ -225,151 +302,294 @@ void state_set(struct settings* s, int argc, char* argv[argc]){
     }
     return;
   }
-  if(!strcmp(argv[0], "intonation")){
+  if(token_is(argv[0], "tune")){
+    // :tune note octave frequency, changes the base pitch so that the note has that frequency
+    if(argc != 4)
+      return;
+    const long double factor = intonation_get_note_factor(s->intonation, argv[1]);
+    long octave;
+    struct token frequency = argv[3];
+    long double value;
+    if(!factor || !token_to_long(argv[2], &octave) || !token_parse_number(&frequency, &value) || frequency.length || !(value > 0)){
+      fprintf(stderr, "invalid tuning: %.*s %.*s %.*s\n", (int)argv[1].length, argv[1].data, (int)argv[2].length, argv[2].data, (int)argv[3].length, argv[3].data);
+      return;
+    }
+    s->c4 = value / ((powl(2, octave) / 16) * factor);
+    return;
+  }
+  if(token_is(argv[0], "intonation")){
     if(argc != 2)
       return;
     for(size_t i=0; i<INTONATION_COUNT; i++){
-      if(strcmp(intonation[i].name, argv[1]))
+      if(!token_is(argv[1], intonation[i].name))
         continue;
       s->intonation = &intonation[i];
       return;
     }
-    fprintf(stderr, "unknown intonation: %s\n", argv[1]);
+    fprintf(stderr, "unknown intonation: %.*s\n", (int)argv[1].length, argv[1].data);
+    return;
   }
-}
-
-void tracker_remove_generator(struct generator **pit){
-  struct generator *it = *pit;
-  *pit = it->next;
-  free(it);
-}
-
-int64_t tracker_generate_sample(struct tracker* tracker){
-  int64_t amplitude = 0;
-  for(struct generator **pit=&tracker->generator_list; *pit; pit=(*pit)?&(*pit)->next:pit){
-    struct generator *it = *pit;
-    const uint64_t time = it->time++;
-    if(time >= it->duration){
-      tracker_remove_generator(pit);
-      continue;
+  if(token_is(argv[0], "envelope")){
+    // :envelope decay [half-time] or :envelope adsr attack decay sustain release
+    enum envelope_type type = 0;
+    for(; type<ENVELOPE_TYPE_COUNT; type++)
+      if(argc >= 2 && token_is(argv[1], envelope_type_name[type]))
+        break;
+    switch(type){
+      case ENVELOPE_DECAY: {
+        long double decay = argc == 3 ? parse_time(s, argv[2]) : SETTINGS_DEFAULT_DECAY;
+        if(argc > 3 || !(decay > 0))
+          break;
+        s->envelope = type;
+        s->decay = decay;
+      } return;
+      case ENVELOPE_ADSR: {
+        if(argc != 6)
+          break;
+        struct token sustain_token = argv[4];
+        long double attack, decay, sustain, release;
+        if(!token_parse_number(&sustain_token, &sustain) || sustain_token.length || !(sustain >= 0 && sustain <= 1))
+          break;
+        if(!try_parse_time(s, argv[2], &attack) || !try_parse_time(s, argv[3], &decay) || !try_parse_time(s, argv[5], &release))
+          break;
+        if(!(attack >= 0) || !(decay >= 0) || !(release >= 0))
+          break;
+        s->envelope = type;
+        s->attack = attack;
+        s->decay = decay;
+        s->sustain = sustain;
+        s->release = release;
+      } return;
+      case ENVELOPE_TYPE_COUNT: break;
     }
-    const long double half_time = 0.1;
-    int32_t a = tracker->samples_per_second * half_time / (time+tracker->samples_per_second*half_time) * 0x7FFF;
-    amplitude += (int64_t)tone_get_sample(&it->tone) * a / 0x7FFF;
+    fprintf(stderr, "invalid envelope:");
+    for(int i=1; i<argc; i++)
+      fprintf(stderr, " %.*s", (int)argv[i].length, argv[i].data);
+    fprintf(stderr, "\n");
+    return;
   }
-  return amplitude;
-}
-
-void write_sample(const struct tracker* tracker, int64_t sample){
-  switch(tracker->format){
-    case F_FLOAT_64: {
-      double f = (long double)sample / 0x8000;
-      static_assert(sizeof(f) == 8);
-      write(1, &f, 4);
-    } break;
-    case F_FLOAT_32: {
-      float f = (long double)sample / 0x8000;
-      static_assert(sizeof(f) == 4);
-      write(1, &f, 4);
-    } break;
-    case F_INT_32: {
-      if(sample > 0x7FFFFFFF)
-        sample = 0x7FFFFFFF;
-      if(sample < -0x7FFFFFFF)
-        sample = -0x7FFFFFFF;
-      write(1, (int32_t[]){sample,sample>>8,sample>>16,sample>>24}, 4);
-    } break;
+  if(token_is(argv[0], "waveform")){
+    if(argc != 2)
+      return;
+    for(size_t i=0; i<WAVEFORM_COUNT; i++){
+      if(!token_is(argv[1], waveform_name[i]))
+        continue;
+      s->waveform = i;
+      return;
+    }
+    fprintf(stderr, "unknown waveform: %.*s\n", (int)argv[1].length, argv[1].data);
+    return;
   }
 }
 
-void tracker_generate(struct tracker* tracker, int argc, char* argv[argc]){
+void tracker_generate(struct tracker* tracker, int argc, const struct token argv[argc]){
   uint64_t time = ~0;
   if(argc)
-    time = (uint64_t)tracker->samples_per_second * parse_time(&tracker->settings, argv[0]) / tracker->settings.speed;
-  while(tracker->generator_list){
-    if(time != (uint64_t)~0)
-      if(!time--)
-        break;
-    int64_t amplitude = tracker_generate_sample(tracker);
-    if(tracker->stats.min > amplitude)
-      tracker->stats.min = amplitude;
-    if(tracker->stats.max < amplitude)
-      tracker->stats.max = amplitude;
-    tracker->stats.abs_sum += amplitude < 0 ? -amplitude : amplitude;
-    tracker->stats.square_sum += amplitude * amplitude;
-    tracker->stats.samples_total++;
-    write_sample(tracker, amplitude);
-  }
+    time = (uint64_t)tracker->config.samples_per_second * parse_time(&tracker->settings, argv[0]) / tracker->settings.speed;
+  timeline_advance(&tracker->timeline, time);
 }
 
-long double parse_time(const struct settings*const s, const char*const restrict input){
-  double nominator=1, denominator=1;
-  char unit[3] = {0};
-  int ret = sscanf(input, "%lf/%lf%2s", &nominator, &denominator, unit);
-  if(ret == 1)
-    ret = sscanf(input, "%lf%2s", &nominator, unit);
-  if(ret == EOF || ret <= 0)
-    return 0;
-  long double time = (long double)nominator / denominator;
-  if(!*unit){
+// Returns false if input isn't a time
+bool try_parse_time(const struct settings*const s, struct token input, long double* result){
+  long double nominator=1, denominator=1;
+  if(!token_parse_number(&input, &nominator))
+    return false;
+  if(input.length && *input.data == '/'){
+    input.data++;
+    input.length--;
+    if(!token_parse_number(&input, &denominator))
+      return false;
+  }
+  // The parts are doubles, as they always have been, so the timing of existing tracks doesn't change
+  long double time = (long double)(double)nominator / (double)denominator;
+  struct token unit = input;
+  if(!unit.length){
     time *= s->tempo;
-  }else if(!strcmp(unit, "s")){
-  }else if(!strcmp(unit, "ms")){
+  }else if(token_is(unit, "s")){
+  }else if(token_is(unit, "ms")){
     time /= 1000;
-  }else if(!strcmp(unit, "m")){
+  }else if(token_is(unit, "m")){
     time *= 60;
-  }else if(!strcmp(unit, "h")){
+  }else if(token_is(unit, "h")){
     time *= 60 * 60;
-  }else return 0;
-  return time;
+  }else return false;
+  *result = time;
+  return true;
 }
 
-void tracker_add_generator(struct generator** list, const struct generator*restrict const entry){
-  struct generator* e = malloc(sizeof(*entry));
-  *e = *entry;
-  e->next = *list;
-  *list = e;
+// 0 if input isn't a time
+long double parse_time(const struct settings*const s, struct token input){
+  long double time;
+  return try_parse_time(s, input, &time) ? time : 0;
 }
 
-void tracker_add_note(struct tracker* tracker, int argc, char* argv[argc]){
+// Adds a voice with the current settings, which is released gate samples after it starts
+bool tracker_add_voice(struct tracker* tracker, uint64_t start, struct pitch pitch, uint64_t gate, uint16_t amplitude){
+  const struct settings*const s = &tracker->settings;
+  struct voice voice = {0};
+  voice.start = start;
+  voice.waveform = s->waveform;
+  voice.increment = pitch.increment;
+  voice.phase = voice.increment; // The first sample is one step into the period
+  voice.amplitude = amplitude;
+  if(tracker->config.wavetable != WAVETABLE_OFF){
+    voice.table = wavetable_get(voice.waveform, voice.increment);
+    if(!voice.table)
+      return false;
+  }
+  const uint32_t sps = tracker->config.samples_per_second;
+  voice.envelope = (struct envelope){
+    .type = s->envelope,
+    .sustain = s->sustain * ENVELOPE_MAX,
+    .attack = fminl(sps * s->attack, UINT32_MAX),
+    .decay = fminl(sps * s->decay, UINT32_MAX),
+    .release = fminl(sps * s->release, UINT32_MAX),
+  };
+  // The decay envelope halves after decay samples, shorter times would divide by zero
+  if(voice.envelope.type == ENVELOPE_DECAY && !voice.envelope.decay)
+    voice.envelope.decay = 1;
+  voice.gate = gate;
+  voice.duration = voice.gate;
+  if(s->envelope == ENVELOPE_ADSR)
+    voice.duration += voice.envelope.release;
+  // Round up to whole periods, so the note ends close to where its wave crosses zero
+  const long double period = 0x100000000 / (long double)voice.increment; // in samples
+  voice.duration = ceill(ceill(voice.duration / period) * period);
+  return timeline_add(&tracker->timeline, &voice);
+}
+
+void tracker_add_note(struct tracker* tracker, int argc, const struct token argv[argc]){
   const int oargc = argc;
-  char**const oargv = argv;
+  const struct token*const oargv = argv;
   if(!argc) goto error;
   const struct settings*const s = &tracker->settings;
-  const long double factor = intonation_get_note_factor(s->intonation, argv[0]);
-  if(!factor) goto error;
-  if(!--argc) goto error;
-  argv += 1;
-  int octave = atoi(argv[0]);
-  const long double frequency = s->c4 * (powl(2, octave) / 16) * factor;
-  if(!frequency) goto error;
-  if(!--argc) goto error;
-  argv += 1;
-  struct generator g = {0};
-  g.tone.tracker = tracker;
-  g.tone.waveform = sg_sin;
-  g.tone.duration = tracker->samples_per_second / frequency;
-  g.duration = tracker->samples_per_second * parse_time(s, argv[0]) / s->speed;
-  g.duration = (g.duration + g.tone.duration - 1) / g.tone.duration * g.tone.duration; // Round up to whole wave
-  tracker_add_generator(&tracker->generator_list, &g);
+  if(argc < 3) goto error;
+  long octave;
+  if(!token_to_long(argv[1], &octave)) goto error;
+  const struct pitch pitch = tracker_get_pitch(tracker, argv[0], octave);
+  if(!pitch.increment) goto error;
+  argc -= 2;
+  argv += 2;
+  const uint64_t gate = tracker->config.samples_per_second * parse_time(s, argv[0]) / s->speed;
+  if(!tracker_add_voice(tracker, tracker->timeline.length, pitch, gate, VOICE_AMPLITUDE_MAX)) goto error;
   return;
 error:
   fprintf(stderr, "%lu: tracker_add_note failed:", tracker->line);
   for(int i=0; i<oargc; i++)
-    fprintf(stderr, " %s", oargv[i]);
+    fprintf(stderr, " %.*s", (int)oargv[i].length, oargv[i].data);
   fprintf(stderr, "\n");
 }
 
-typedef void cmd_func(struct tracker* tracker, int argc, char* argv[argc]);
-struct cmd {
-  const char* name;
-  cmd_func* call;
-};
+typedef void cmd_func(struct tracker* tracker, int argc, const struct token argv[argc]);
 
-const struct cmd cmd_list[] = {
-  { ">>", tracker_generate },
-  { "n", tracker_add_note }
-};
+// There are only a few commands, a switch on their first character finds them without comparing strings
+cmd_func* cmd_lookup(struct token name){
+  switch(name.length ? name.data[0] : 0){
+    case '>': return token_is(name, ">>") ? tracker_generate : 0;
+    case 'n': return name.length == 1 ? tracker_add_note : 0;
+  }
+  return 0;
+}
+
+void tracker_parse(struct tracker* tracker, size_t size, const char input[size]){
+  struct tokenizer tokenizer;
+  tokenizer_init(&tokenizer, size, input);
+  for(; tokenizer_next_line(&tokenizer); tracker->line += 1){
+    struct token token;
+    bool more = tokenizer_next(&tokenizer, &token);
+    if(more && *token.data == '#')
+      continue;
+    while(more){
+      int cmdargc = 0;
+      struct token cmdargv[32];
+      for(; more; more = tokenizer_next(&tokenizer, &token)){
+        if(*token.data == '#'){
+          more = false;
+          break;
+        }
+        if(cmdargc && (token_is(token, ">>") || *token.data == ':'))
+          break;
+        if((unsigned)cmdargc < sizeof(cmdargv)/sizeof(*cmdargv))
+          cmdargv[cmdargc++] = token;
+      }
+      if(!cmdargc)
+        break;
+      if(*cmdargv[0].data == ':'){
+        cmdargv[0].data += 1;
+        cmdargv[0].length -= 1;
+        state_set(&tracker->settings, cmdargc, cmdargv);
+      }else{
+        cmd_func*const cmd = cmd_lookup(cmdargv[0]);
+        if(cmd){
+          cmd(tracker, cmdargc-1, cmdargv+1);
+        }else{
+          fprintf(stderr, "unknown command: %.*s\n", (int)cmdargv[0].length, cmdargv[0].data);
+        }
+      }
+    }
+  }
+  tracker_generate(tracker, 0, 0);
+}
+
+// Adds a note of a MIDI file, the velocity sets the amplitude, squared like the General MIDI volume curve
+static bool tracker_add_midi_note(struct tracker* tracker, const struct midi_note* note){
+  const char*const name = midi_key_name[note->key % 12];
+  const struct pitch pitch = tracker_get_pitch(tracker, (struct token){ .data = name, .length = strlen(name) }, midi_key_octave(note->key));
+  if(!pitch.increment)
+    return true;
+  const uint16_t amplitude = roundl((long double)VOICE_AMPLITUDE_MAX * note->velocity_start * note->velocity_start / (127 * 127));
+  return tracker_add_voice(tracker, note->time, pitch, note->duration, amplitude);
+}
+
+/*
+ * Turns the notes of a standard MIDI file into voices, at the exact time the tempo map gives them.
+ * The keys are the same notes midi2trk writes for them. Notes still playing at the end last until the last event.
+ */
+bool tracker_load_midi(struct tracker* tracker, size_t size, const uint8_t data[size], unsigned threads){
+  const uint32_t sps = tracker->config.samples_per_second;
+  struct smf smf;
+  if(smf_parse(&smf, size, data))
+    return false;
+  struct tempo_map map = {0};
+  struct smf_merge merge = {0};
+  struct midi_notes*const notes = malloc(sizeof(*notes));
+  if(!notes)
+    fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+  else
+    midi_notes_init(notes);
+  bool ok = notes && !smf_decode(&smf, threads) && smf_tempo_map(&smf, &map) && smf_merge_init(&merge, &smf);
+  uint64_t time = 0;
+  for(const struct midi_event* e; ok && (e = smf_merge_next(&merge)); ){
+    time = tempo_map_scale(&map, tempo_map_next(&map, e->time), sps);
+    if(e->type != MIDI_MESSAGE_NOTE_ON_EVENT && e->type != MIDI_MESSAGE_NOTE_OFF_EVENT)
+      continue;
+    if(e->len < 2)
+      continue;
+    const uint8_t*const d = e->data;
+    if(e->type == MIDI_MESSAGE_NOTE_ON_EVENT && d[1]){
+      ok = midi_notes_start(notes, e->channel, time, d[0], d[1]);
+      continue;
+    }
+    // A note off, or a note on without velocity
+    if(!midi_notes_stop(notes, e->channel, time, d[0], d[1]))
+      continue;
+    // The voices are added in the order they start
+    for(struct midi_note* n; ok && (n = midi_notes_next(notes, false, 0)); midi_notes_free(notes, n))
+      ok = tracker_add_midi_note(tracker, n);
+  }
+  for(struct midi_note* n; ok && (n = midi_notes_next(notes, true, time)); midi_notes_free(notes, n))
+    ok = tracker_add_midi_note(tracker, n);
+  if(ok)
+    timeline_advance(&tracker->timeline, ~(uint64_t)0);
+  if(notes){
+    midi_notes_destroy(notes);
+    free(notes);
+  }
+  smf_merge_destroy(&merge);
+  tempo_map_destroy(&map);
+  smf_destroy(&smf);
+  return ok;
+}
 
 void setattri(int fd, const char* name, long long value){
   char buf[64];
@@ -379,68 +599,449 @@ void setattri(int fd, const char* name, long long value){
   }
 }
 
+// Prints the stats as "name value" lines, the peaks of the windows go on one line
+void print_stats(const struct stats* stats){
+  const long double samples = stats->samples_total ? stats->samples_total : 1;
+  const long double rms = sqrtl(stats->square_sum / samples);
+  printf("samples %llu\n", (unsigned long long)stats->samples_total);
+  // An empty track has no extremes, and silence no ratios, they are 0 instead
+  printf("min %lld\n", stats->samples_total ? (long long)stats->min : 0);
+  printf("max %lld\n", stats->samples_total ? (long long)stats->max : 0);
+  printf("peak %llu\n", (unsigned long long)stats->peak);
+  printf("true_peak %lld\n", (long long)stats->true_peak);
+  printf("abs_avg %lld\n", (long long)(stats->abs_sum / samples));
+  printf("rms %lld\n", (long long)rms);
+  printf("factor %lld\n", rms ? (long long)((long double)0x80000000 / rms) : 0);
+  printf("peak_factor %lld\n", stats->true_peak ? (long long)((long double)0x7FFFFFFF / stats->true_peak) : 0);
+  printf("voices_max %zu\n", stats->voices_max);
+  printf("window_peaks");
+  for(size_t i=0; i<stats->window_count; i++)
+    printf(" %llu", (unsigned long long)stats->window_peak[i]);
+  printf("\n");
+}
+
+void usage(const char* name){
+  fprintf(stderr,
+    "Usage: %s [options] <input.trk >output.wav\n"
+    "       %s [options] <input.mid >output.wav\n"
+    "       %s [options] --timeline input.tl >output.wav\n"
+    "       %s [options] --compile output.tl <input.trk\n"
+    "Options:\n"
+    "  -f, --format FORMAT      Sample format of the output: int16, int24, int32 (default), float32 or float64\n"
+    "  -r, --rate HZ           Sample rate of the output, default %u\n"
+    "  -b, --block-size BYTES  Size of the output blocks, default %u, suffixes k and M are allowed\n"
+    "      --no-mmap           Don't write to the output file through a memory mapping\n"
+    "      --oscillator NAME   Oscillator implementation: auto (default), avx2, sse2, scalar,\n"
+    "                          or exact for the slow reference implementation\n"
+    "      --voices COUNT      Number of voices to allocate up front, default %u\n"
+    "      --wavetable MODE    Read the waveforms from precomputed band-limited tables, using\n"
+    "                          linear or cubic interpolation. Default: off\n"
+    "  -j, --threads COUNT     Render segments of the track in parallel, 0 uses all CPUs. Default: 1\n"
+    "      --mix-threads COUNT Mix the voices of dense passages using several threads, 0 uses all CPUs.\n"
+    "                          Default: 1\n"
+    "      --stream            Play the track in real time while it's rendered, instead of as fast as possible\n"
+    "      --latency MS        How far the output may run ahead of the playback when streaming, default %u\n"
+    "  -c, --compile FILE      Only parse the track, and save its timeline to FILE, for use with --timeline\n"
+    "      --timeline FILE     Render a track compiled with --compile, instead of reading one from stdin\n"
+    "      --cache FILE        Render the timeline in FILE if it was compiled from the same track,\n"
+    "                          otherwise compile the track to FILE first\n"
+    "      --from SECONDS      Only render the track from this point on\n"
+    "      --to SECONDS        Only render the track up to this point. The samples are the same as in a full\n"
+    "                          render, except near either end when using the limiter\n"
+    "  -o, --output FILE       Write to FILE instead of stdout\n"
+    "      --checkpoint FILE   Save the progress to FILE every %u seconds of audio. If FILE exists, continue the\n"
+    "                          render from there. Needs a file as output, which isn't truncated, use -o\n"
+    "      --gain FACTOR       Multiply the samples by FACTOR, default 1\n"
+    "      --normalize PEAK    Compute the true peak of the track first, and scale it to PEAK, a fraction of\n"
+    "                          full scale. Combines with --gain\n"
+    "      --limit CEILING     Keep the samples below CEILING, a fraction of full scale, using a look-ahead limiter\n"
+    "      --lookahead MS      How far the limiter looks ahead, this delays the output, default %u\n"
+    "      --no-dither         Round the samples without TPDF dither when reducing their resolution\n"
+    "      --stats-only        Only compute the statistics of the track, and print them instead of the samples\n"
+    "      --stats-window MS   Length of the windows the peak is reported for with --stats-only, default %u\n"
+    "  -h, --help              Show this help\n",
+    name, name, name, name, COMMON_SAMPLE_RATE_48, OUTPUT_DEFAULT_BLOCK_SIZE, RENDER_DEFAULT_VOICES, STREAM_DEFAULT_LATENCY_MS, CHECKPOINT_DEFAULT_INTERVAL, MASTER_DEFAULT_LOOKAHEAD_MS, STATS_DEFAULT_WINDOW_MS
+  );
+}
+
+size_t parse_size(const char* s){
+  char* end = 0;
+  unsigned long long size = strtoull(s, &end, 0);
+  if(end == s)
+    return 0;
+  switch(*end){
+    case 'k': case 'K': size *= 1024; end++; break;
+    case 'm': case 'M': size *= 1024 * 1024; end++; break;
+  }
+  if(*end)
+    return 0;
+  return size;
+}
+
 int main(int argc, char* argv[]){
-  (void)argc;
-  (void)argv;
+  enum output_format format = F_INT_32;
+  uint32_t samples_per_second = COMMON_SAMPLE_RATE_48;
+  size_t block_size = OUTPUT_DEFAULT_BLOCK_SIZE;
+  bool allow_mmap = true;
+  const struct oscillator* oscillator = oscillator_lookup("auto");
+  enum wavetable_mode wavetable = WAVETABLE_OFF;
+  size_t voices = RENDER_DEFAULT_VOICES;
+  long threads = 1;
+  long mix_threads = 1;
+  bool stream = false;
+  unsigned latency_ms = STREAM_DEFAULT_LATENCY_MS;
+  const char* compile_path = 0;
+  const char* timeline_path = 0;
+  const char* cache_path = 0;
+  const char* output_path = 0;
+  const char* checkpoint_path = 0;
+  bool stats_only = false;
+  unsigned stats_window_ms = STATS_DEFAULT_WINDOW_MS;
+  double gain = 1;
+  double normalize = 0;
+  double limit = 0;
+  unsigned lookahead_ms = MASTER_DEFAULT_LOOKAHEAD_MS;
+  bool dither = true;
+  double from = 0;
+  double to = 0; // 0 is the end
+  enum { OPT_NO_MMAP = 0x100, OPT_OSCILLATOR, OPT_WAVETABLE, OPT_VOICES, OPT_MIX_THREADS, OPT_STREAM, OPT_LATENCY, OPT_TIMELINE, OPT_CACHE, OPT_STATS_ONLY, OPT_STATS_WINDOW, OPT_GAIN, OPT_NORMALIZE, OPT_LIMIT, OPT_LOOKAHEAD, OPT_NO_DITHER, OPT_CHECKPOINT, OPT_FROM, OPT_TO };
+  static const struct option long_options[] = {
+    {"format",     required_argument, 0, 'f'},
+    {"rate",       required_argument, 0, 'r'},
+    {"block-size", required_argument, 0, 'b'},
+    {"no-mmap",    no_argument,       0, OPT_NO_MMAP},
+    {"oscillator", required_argument, 0, OPT_OSCILLATOR},
+    {"wavetable",  required_argument, 0, OPT_WAVETABLE},
+    {"voices",     required_argument, 0, OPT_VOICES},
+    {"threads",    required_argument, 0, 'j'},
+    {"mix-threads", required_argument, 0, OPT_MIX_THREADS},
+    {"stream",     no_argument,       0, OPT_STREAM},
+    {"latency",    required_argument, 0, OPT_LATENCY},
+    {"compile",    required_argument, 0, 'c'},
+    {"timeline",   required_argument, 0, OPT_TIMELINE},
+    {"cache",      required_argument, 0, OPT_CACHE},
+    {"stats-only", no_argument,       0, OPT_STATS_ONLY},
+    {"stats-window", required_argument, 0, OPT_STATS_WINDOW},
+    {"gain",       required_argument, 0, OPT_GAIN},
+    {"normalize",  required_argument, 0, OPT_NORMALIZE},
+    {"limit",      required_argument, 0, OPT_LIMIT},
+    {"lookahead",  required_argument, 0, OPT_LOOKAHEAD},
+    {"no-dither",  no_argument,       0, OPT_NO_DITHER},
+    {"output",     required_argument, 0, 'o'},
+    {"checkpoint", required_argument, 0, OPT_CHECKPOINT},
+    {"from",       required_argument, 0, OPT_FROM},
+    {"to",         required_argument, 0, OPT_TO},
+    {"help",       no_argument,       0, 'h'},
+    {0}
+  };
+  for(int c; (c = getopt_long(argc, argv, "f:r:b:j:c:o:h", long_options, 0)) != -1;){
+    switch(c){
+      case 'f': {
+        for(format=0; format<OUTPUT_FORMAT_COUNT; format++)
+          if(!strcmp(output_format_name[format], optarg))
+            break;
+        if(format == OUTPUT_FORMAT_COUNT){
+          fprintf(stderr, "unknown sample format: %s\n", optarg);
+          return 1;
+        }
+      } break;
+      case 'r': {
+        char* end = 0;
+        unsigned long rate = strtoul(optarg, &end, 0);
+        if(end == optarg || *end || rate < SAMPLE_RATE_MIN || rate > SAMPLE_RATE_MAX){
+          fprintf(stderr, "sample rate must be between %u and %u Hz\n", SAMPLE_RATE_MIN, SAMPLE_RATE_MAX);
+          return 1;
+        }
+        samples_per_second = rate;
+      } break;
+      case 'b': {
+        block_size = parse_size(optarg);
+        if(block_size < OUTPUT_MIN_BLOCK_SIZE || block_size > OUTPUT_MAX_BLOCK_SIZE){
+          fprintf(stderr, "block size must be between %u and %u bytes\n", OUTPUT_MIN_BLOCK_SIZE, OUTPUT_MAX_BLOCK_SIZE);
+          return 1;
+        }
+      } break;
+      case 'j': case OPT_MIX_THREADS: {
+        char* end = 0;
+        long count = strtol(optarg, &end, 0);
+        if(end == optarg || *end || count < 0){
+          fprintf(stderr, "invalid thread count: %s\n", optarg);
+          return 1;
+        }
+        if(!count)
+          count = sysconf(_SC_NPROCESSORS_ONLN);
+        if(count < 1)
+          count = 1;
+        *(c == 'j' ? &threads : &mix_threads) = count;
+      } break;
+      case OPT_NO_MMAP: allow_mmap = false; break;
+      case OPT_OSCILLATOR: {
+        oscillator = oscillator_lookup(optarg);
+        if(!oscillator){
+          fprintf(stderr, "unknown or unsupported oscillator: %s\n", optarg);
+          return 1;
+        }
+      } break;
+      case OPT_WAVETABLE: {
+        for(wavetable=0; wavetable<WAVETABLE_MODE_COUNT; wavetable++)
+          if(!strcmp(wavetable_mode_name[wavetable], optarg))
+            break;
+        if(wavetable == WAVETABLE_MODE_COUNT){
+          fprintf(stderr, "unknown wavetable mode: %s\n", optarg);
+          return 1;
+        }
+      } break;
+      case OPT_VOICES: {
+        char* end = 0;
+        voices = strtoul(optarg, &end, 0);
+        if(end == optarg || *end){
+          fprintf(stderr, "invalid voice count: %s\n", optarg);
+          return 1;
+        }
+      } break;
+      case OPT_STREAM: stream = true; break;
+      case 'c': compile_path = optarg; break;
+      case OPT_TIMELINE: timeline_path = optarg; break;
+      case OPT_CACHE: cache_path = optarg; break;
+      case 'o': output_path = optarg; break;
+      case OPT_CHECKPOINT: checkpoint_path = optarg; break;
+      case OPT_LATENCY: {
+        char* end = 0;
+        unsigned long ms = strtoul(optarg, &end, 0);
+        if(end == optarg || *end || ms > 60000){
+          fprintf(stderr, "invalid latency: %s\n", optarg);
+          return 1;
+        }
+        latency_ms = ms;
+      } break;
+      case OPT_STATS_ONLY: stats_only = true; break;
+      case OPT_STATS_WINDOW: {
+        char* end = 0;
+        unsigned long ms = strtoul(optarg, &end, 0);
+        if(end == optarg || *end || !ms || ms > 3600000){
+          fprintf(stderr, "invalid stats window: %s\n", optarg);
+          return 1;
+        }
+        stats_window_ms = ms;
+      } break;
+      case OPT_GAIN: case OPT_NORMALIZE: case OPT_LIMIT: {
+        char* end = 0;
+        double value = strtod(optarg, &end);
+        if(end == optarg || *end || !(value > 0) || !isfinite(value) || (c != OPT_GAIN && value > 1)){
+          fprintf(stderr, "invalid %s: %s\n", c == OPT_GAIN ? "gain" : c == OPT_NORMALIZE ? "peak" : "ceiling", optarg);
+          return 1;
+        }
+        *(c == OPT_GAIN ? &gain : c == OPT_NORMALIZE ? &normalize : &limit) = value;
+      } break;
+      case OPT_LOOKAHEAD: {
+        char* end = 0;
+        unsigned long ms = strtoul(optarg, &end, 0);
+        if(end == optarg || *end || ms > 1000){
+          fprintf(stderr, "invalid lookahead: %s\n", optarg);
+          return 1;
+        }
+        lookahead_ms = ms;
+      } break;
+      case OPT_NO_DITHER: dither = false; break;
+      case OPT_FROM: case OPT_TO: {
+        char* end = 0;
+        double value = strtod(optarg, &end);
+        if(end == optarg || *end || !(value >= 0) || !isfinite(value) || (c == OPT_TO && !value)){
+          fprintf(stderr, "invalid time: %s\n", optarg);
+          return 1;
+        }
+        *(c == OPT_FROM ? &from : &to) = value;
+      } break;
+      case 'h': usage(argv[0]); return 0;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if(to && to <= from){
+    fprintf(stderr, "--to must be after --from\n");
+    return 1;
+  }
+  if(optind != argc || (timeline_path && (compile_path || cache_path)) || (stats_only && stream) || (checkpoint_path && (stream || stats_only))){
+    usage(argv[0]);
+    return 1;
+  }
   struct tracker tracker = {
     .settings = {
       .c4 = 261.6,
       .speed = 1,
       .tempo = 1,
       .intonation = &intonation[INTONATION_EQUAL],
+      .waveform = WAVEFORM_SIN,
+      .envelope = ENVELOPE_DECAY,
+      .decay = SETTINGS_DEFAULT_DECAY,
     },
     .line = 1,
-    .stats.min =  INFINITY,
-    .stats.max = -INFINITY,
-    .format = F_INT_32,
-    .samples_per_second = COMMON_SAMPLE_RATE_48,
+    .config = {
+      .samples_per_second = samples_per_second,
+      .format = format,
+      .oscillator = oscillator,
+      .wavetable = wavetable,
+      .voices = voices,
+      .mix_threads = mix_threads,
+      .begin = llround(from * samples_per_second),
+      .end = llround(to * samples_per_second),
+      .master = {
+        .gain = gain,
+        .ceiling = limit * 0x7FFFFFFF,
+        .lookahead = (uint64_t)samples_per_second * lookahead_ms / 1000,
+        .release = (uint64_t)samples_per_second * MASTER_DEFAULT_RELEASE_MS / 1000,
+        .dither = dither,
+      },
+    },
   };
-  { write(1, mk_wav(1, tracker.samples_per_second, tracker.format).data, sizeof(struct wav_header)); };
-  for(char buf[256]; fgets(buf, sizeof(buf), stdin);){
-    char* pch = strtok(buf," \t\r\n");
-    if(pch && *pch && *pch != '#')
-    do {
-      int cmdargc = 0;
-      char* cmdargv[32];
-      for(; pch; pch = strtok(0, " \t\r\n")){
-        if(pch[0] == '#'){
-          pch = 0;
-          break;
-        }
-        if(cmdargc && (!strcmp(pch, ">>") || pch[0] == ':'))
-          break;
-        cmdargv[cmdargc++] = pch;
-        if((unsigned)cmdargc >= sizeof(cmdargv)/sizeof(*cmdargv))
-          break;
-      }
-      if(!cmdargc) continue;
-      if(cmdargv[0][0] == ':'){
-        cmdargv[0] += 1;
-        state_set(&tracker.settings, cmdargc, cmdargv);
+  if(timeline_path){
+    const int ret = timeline_load(timeline_path, &tracker.timeline, &tracker.config, 0);
+    if(ret > 0)
+      fprintf(stderr, "%s: not a track compiled by this version for this sample rate\n", timeline_path);
+    if(ret)
+      return 1;
+  }else{
+    struct source source;
+    if(source_open(&source, 0))
+      return 1;
+    uint64_t hash = 0;
+    if(cache_path || compile_path)
+      hash = timeline_source_hash(source.size, source.data);
+    int cached = 1;
+    if(cache_path){
+      cached = timeline_load(cache_path, &tracker.timeline, &tracker.config, hash);
+      if(cached < 0)
+        return 1;
+    }
+    if(cached){
+      const uint8_t*const data = (const uint8_t*)source.data;
+      if(smf_is(source.size, data)){
+        if(!tracker_load_midi(&tracker, source.size, data, threads))
+          return 1;
       }else{
-        const struct cmd* cmd = 0;
-        for(size_t i=0; i<sizeof(cmd_list)/sizeof(*cmd_list); i++){
-          if(strcmp(cmd_list[i].name, cmdargv[0]))
-            continue;
-          cmd = &cmd_list[i];
-          break;
-        }
-        if(cmd){
-          cmd->call(&tracker, cmdargc-1, cmdargv+1);
-        }else{
-          fprintf(stderr, "unknown command: %s\n", cmdargv[0]);
-        }
+        tracker_parse(&tracker, source.size, source.data);
       }
-    } while(pch);
-    tracker.line += 1;
+      if(cache_path && timeline_save(cache_path, &tracker.timeline, tracker.config.samples_per_second, hash))
+        return 1;
+    }
+    source_close(&source);
+    if(compile_path){
+      if(timeline_save(compile_path, &tracker.timeline, tracker.config.samples_per_second, hash))
+        return 1;
+      timeline_destroy(&tracker.timeline);
+      return 0;
+    }
+  }
+  struct stats stats;
+  stats_init(&stats, stats_only ? (uint64_t)tracker.config.samples_per_second * stats_window_ms / 1000 : 0);
+  if(stats_only){
+    const bool ok = !render_timeline(&tracker.config, &tracker.timeline, &stats, 0, threads, 0) && stats_finish(&stats);
+    timeline_destroy(&tracker.timeline);
+    if(ok)
+      print_stats(&stats);
+    stats_destroy(&stats);
+    return !ok;
+  }
+  // Full scale is the same for every format, a single voice is only half a step of int16
+  if(format == F_INT_16 && gain == 1 && !normalize)
+    fprintf(stderr, "int16 output without --gain or --normalize is mostly dither, a voice is half a step of it\n");
+  if(normalize){
+    // A first pass over the whole timeline, only to find the peak, so a part gets the same gain as in a full render
+    struct render_config config = tracker.config;
+    config.begin = config.end = 0;
+    struct stats peak;
+    stats_init(&peak, 0);
+    const bool ok = !render_timeline(&config, &tracker.timeline, &peak, 0, threads, 0) && stats_finish(&peak);
+    stats_destroy(&peak);
+    if(!ok)
+      return 1;
+    if(peak.true_peak > 0)
+      tracker.config.master.gain *= normalize * 0x7FFFFFFF / peak.true_peak;
+  }
+  if(output_path){
+    // A checkpoint can only continue what's already in the file
+    const int fd = open(output_path, O_RDWR | O_CREAT | O_CLOEXEC | (checkpoint_path ? 0 : O_TRUNC), 0644);
+    if(fd == -1){
+      fprintf(stderr, "%s: %s\n", output_path, strerror(errno));
+      return 1;
+    }
+    if(dup2(fd, 1) == -1){
+      fprintf(stderr, "%s:%u: dup2 failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return 1;
+    }
+    close(fd);
+  }
+  uint64_t begin, end;
+  render_window(&tracker.config, &tracker.timeline, &begin, &end);
+  const struct wav_header header = mk_wav(1, tracker.config.samples_per_second, tracker.config.format, end - begin);
+  struct checkpoint checkpoint = {
+    .path = checkpoint_path,
+    .identity = checkpoint_identity(&tracker.config, &tracker.timeline),
+    .interval = (uint64_t)tracker.config.samples_per_second * CHECKPOINT_DEFAULT_INTERVAL,
+  };
+  bool resume = false;
+  if(checkpoint_path){
+    struct stat st;
+    if(fstat(1, &st) == -1 || !S_ISREG(st.st_mode)){
+      fprintf(stderr, "checkpoints need a file as output\n");
+      return 1;
+    }
+    const int ret = checkpoint_load(&checkpoint, &tracker.config, &stats);
+    if(ret < 0)
+      return 1;
+    const off_t position = header.size + checkpoint.written * output_sample_size(tracker.config.format);
+    resume = !ret;
+    if(resume && st.st_size < position){
+      fprintf(stderr, "%s: the output is shorter than at the checkpoint, starting over\n", checkpoint_path);
+      checkpoint_destroy(&checkpoint);
+      stats_init(&stats, 0);
+      checkpoint.time = checkpoint.written = 0;
+      resume = false;
+    }
+    if(resume)
+      fprintf(stderr, "%s: continuing at %.3fs\n", checkpoint_path, (double)checkpoint.time / tracker.config.samples_per_second);
+    if(ftruncate(1, resume ? position : 0) == -1 || lseek(1, resume ? position : 0, SEEK_SET) == -1){
+      fprintf(stderr, "%s:%u: ftruncate / lseek failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return 1;
+    }
+  }
+  struct output output;
+  if(output_init(&output, 1, block_size, allow_mmap && !stream))
+    return 1;
+  if(!resume && output_write(&output, header.size, header.data))
+    return 1;
+  if(stream){
+    // The header goes out first, the samples are written directly
+    struct stream_report report;
+    if(output_flush(&output))
+      return 1;
+    if(render_stream(&tracker.config, &tracker.timeline, &stats, 1, latency_ms, &report))
+      return 1;
+    if(report.underruns)
+      fprintf(stderr, "%u underruns, %.3fs without output\n", report.underruns, (double)report.underrun_samples / tracker.config.samples_per_second);
+  }else{
+    if(render_timeline(&tracker.config, &tracker.timeline, &stats, &output, threads, checkpoint_path ? &checkpoint : 0))
+      return 1;
   }
-  tracker_generate(&tracker, 0, 0);
-  double average_abs_volume = tracker.stats.abs_sum / tracker.stats.samples_total;
-  double average_square_volume = sqrtl(tracker.stats.square_sum / tracker.stats.samples_total);
-  setattri(1, "user.stats.min", tracker.stats.min);
-  setattri(1, "user.stats.max", tracker.stats.max);
+  if(output_close(&output))
+    return 1;
+  checkpoint_destroy(&checkpoint);
+  if(checkpoint_path && checkpoint_remove(&checkpoint))
+    return 1;
+  timeline_destroy(&tracker.timeline);
+  if(!stats_finish(&stats))
+    return 1;
+  const long double samples = stats.samples_total ? stats.samples_total : 1;
+  double average_abs_volume = stats.abs_sum / samples;
+  double average_square_volume = sqrtl(stats.square_sum / samples);
+  setattri(1, "user.stats.min", stats.samples_total ? stats.min : 0);
+  setattri(1, "user.stats.max", stats.samples_total ? stats.max : 0);
+  setattri(1, "user.stats.peak", stats.peak);
+  setattri(1, "user.stats.true_peak", stats.true_peak);
   setattri(1, "user.stats.abs_avg" , average_abs_volume);
   setattri(1, "user.stats.qsum_avg", average_square_volume);
-  setattri(1, "user.stats.factor", (long double)0x80000000 / average_square_volume);
+  setattri(1, "user.stats.factor", average_square_volume ? (long double)0x80000000 / average_square_volume : 0);
+  setattri(1, "user.stats.peak_factor", stats.true_peak ? (long double)0x7FFFFFFF / stats.true_peak : 0);
+  setattri(1, "user.stats.voices_max", stats.voices_max);
+  stats_destroy(&stats);
   return 0;
 }
@@ -0,0 +1,127 @@
+#include <master.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+bool master_enabled(const struct master_config* config, enum output_format format){
+  return config->gain != 1 || config->ceiling > 0 || (config->dither && output_quantum(format) > 1);
+}
+
+bool master_init(struct master* m, const struct master_config* config, enum output_format format){
+  *m = (struct master){
+    .config = *config,
+    .quantum = output_quantum(format),
+    .size = 1,
+    .held = MASTER_GAIN_ONE,
+  };
+  if(config->ceiling <= 0)
+    return true;
+  if(config->lookahead > 1)
+    m->size = config->lookahead;
+  m->delay = calloc(m->size, sizeof(*m->delay));
+  m->hold = calloc(m->size, sizeof(*m->hold));
+  m->minimum = calloc(m->size, sizeof(*m->minimum));
+  if(!m->delay || !m->hold || !m->minimum){
+    fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    master_destroy(m);
+    return false;
+  }
+  for(size_t i=0; i<m->size; i++)
+    m->hold[i] = MASTER_GAIN_ONE;
+  m->hold_sum = MASTER_GAIN_ONE * (int64_t)m->size;
+  return true;
+}
+
+void master_start(struct master* m, uint64_t time){
+  m->length = m->out = time;
+}
+
+// Triangular noise between -1 and 1, depending only on the position of the sample
+static double tpdf(uint64_t position){
+  uint64_t z = position + 0x9E3779B97F4A7C15u;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+  z ^= z >> 31;
+  return ((double)(z >> 32) - (double)(uint32_t)z) / 0x100000000;
+}
+
+// Rounds a sample to the resolution of the output
+static int64_t master_quantize(struct master* m, double sample){
+  const uint64_t position = m->out++;
+  if(m->quantum){
+    sample /= m->quantum;
+    if(m->config.dither)
+      sample += tpdf(position);
+  }
+  sample = floor(sample + 0.5);
+  // Far beyond anything the output formats can represent, output_convert clips it anyway
+  if(sample > 0x1p62)
+    sample = 0x1p62;
+  if(sample < -0x1p62)
+    sample = -0x1p62;
+  return (int64_t)sample * (m->quantum ? m->quantum : 1);
+}
+
+// Feeds a sample through the limiter, returns whether a delayed one came out
+static bool master_limit(struct master* m, double sample, double* out){
+  const double amplitude = fabs(sample);
+  int64_t gain = MASTER_GAIN_ONE;
+  if(amplitude > m->config.ceiling)
+    gain = m->config.ceiling / amplitude * MASTER_GAIN_ONE;
+  // Smallest gain needed within the window, the oldest sample leaves it
+  if(m->minimum_count && m->minimum[m->minimum_first].position + m->size <= m->in){
+    m->minimum_first = (m->minimum_first + 1) % m->size;
+    m->minimum_count--;
+  }
+  while(m->minimum_count && m->minimum[(m->minimum_first + m->minimum_count - 1) % m->size].gain >= gain)
+    m->minimum_count--;
+  m->minimum[(m->minimum_first + m->minimum_count++) % m->size] = (struct master_minimum){m->in, gain};
+  const int64_t needed = m->minimum[m->minimum_first].gain;
+  const int64_t released = m->held + MASTER_GAIN_ONE / (m->config.release ? m->config.release : 1);
+  m->held = released < needed ? released : needed;
+  const size_t i = m->in % m->size;
+  m->hold_sum += m->held - m->hold[i];
+  m->hold[i] = m->held;
+  m->delay[i] = sample;
+  m->in++;
+  if(m->in < m->size)
+    return false;
+  *out = m->delay[m->in % m->size] * ((double)m->hold_sum / ((double)MASTER_GAIN_ONE * m->size));
+  return true;
+}
+
+size_t master_process(struct master* m, size_t n, int64_t mix[n]){
+  size_t count = 0;
+  m->length += n;
+  for(size_t i=0; i<n; i++){
+    double sample = mix[i] * m->config.gain;
+    if(m->config.ceiling > 0 && !master_limit(m, sample, &sample))
+      continue;
+    mix[count++] = master_quantize(m, sample);
+  }
+  return count;
+}
+
+size_t master_flush(struct master* m, size_t n, int64_t mix[n]){
+  size_t count = 0;
+  if(m->config.ceiling <= 0)
+    return 0;
+  // The look-ahead window runs into silence
+  for(; count<n && m->out<m->length; count++){
+    double sample;
+    master_limit(m, 0, &sample);
+    mix[count] = master_quantize(m, sample);
+  }
+  return count;
+}
+
+void master_destroy(struct master* m){
+  free(m->delay);
+  free(m->hold);
+  free(m->minimum);
+  m->delay = 0;
+  m->hold = 0;
+  m->minimum = 0;
+}
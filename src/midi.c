@@ -25,15 +25,14 @@ static inline int parse_variable_length_quantity(size_t len, const uint8_t data[
   return 0;
 }
 
-static inline void dispatch_midi_event(struct midi_event_parser* midi, enum midi_message type, uint32_t len, const uint8_t data[len], enum midi_channel channel){
-  midi->event = (struct midi_event){
+static inline void dispatch_midi_event(struct midi_event_parser* midi, struct midi_event* event, enum midi_message type, uint32_t len, const uint8_t data[len], enum midi_channel channel){
+  *event = (struct midi_event){
     .type = type,
     .time = midi->time,
     .len = len,
     .data = data,
     .channel = channel,
   };
-  midi->got_event = true;
 }
 
 enum parser_state {
@@ -44,11 +43,14 @@ enum parser_state {
   PS_EVENT_META,
 };
 
-ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof){
-  midi->got_event = false;
+// Stops once capacity events were parsed, or at the end of the data
+static inline ssize_t parse(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof, size_t capacity, struct midi_event events[capacity], size_t* count){
   const size_t old_len = len;
-  bool got_next = false;
-#define NEXT(...) { got_next=true; dispatch_midi_event(midi, __VA_ARGS__); }
+  bool got_next = !capacity;
+  *count = 0;
+#define NEXT(...) { dispatch_midi_event(midi, &events[(*count)++], __VA_ARGS__); got_next = *count >= capacity; }
+  // The events before invalid data are still returned, the next call fails without consuming anything
+#define FAIL { if(*count) goto out; return -1; }
   while(len && !got_next){
 
     switch((enum parser_state)midi->state){
@@ -57,7 +59,7 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
           uint32_t timing = 0;
           int vlen = parse_variable_length_quantity(len, data, &timing);
           if(vlen == -1)
-            return -1;
+            FAIL;
           if(vlen == 0)
             goto out;
           midi->time += timing;
@@ -71,9 +73,18 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
         if(len <= 1)
           goto out;
         uint8_t type = data[0];
-        if(!(type & 0x80))
-          return -1;
+        size_t status = 1; // Size of the status byte
+        if(!(type & 0x80)){
+          // Running status, the data follows without repeating the status of the last channel message
+          if(!midi->running_status)
+            FAIL;
+          type = midi->running_status;
+          status = 0;
+        }
+        // Nothing changes before a FAIL, so the next call fails at the same place
+        // System exclusive and system common messages cancel the running status, real time messages don't
         if(type == 0xF7 || type == 0xF0){
+          midi->running_status = 0;
           midi->state = PS_EVENT_SYSEX;
           midi->tmp = type == 0xF0 ? MIDI_MESSAGE_SYSTEM_EXCLUSIVE : MIDI_MESSAGE_END_OF_EXCLUSIVE;
           len -= 1;
@@ -81,26 +92,28 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
         }else if(type == 0xFF && midi->has_timing){
           if(len < 2)
             goto out;
-          midi->state = PS_EVENT_META;
           if(data[1] & 0x80)
-            return -1;
+            FAIL;
+          midi->running_status = 0;
+          midi->state = PS_EVENT_META;
           midi->tmp = data[1] + 0xA0;
           len  -= 2;
           data += 2;
         }else if((type & 0xF0) != 0xF0){
           uint8_t channel = type & 0x0F;
           enum midi_message message = ((type & 0x70)>>4) | 0x80;
-          uint32_t needed = (message == MIDI_MESSAGE_PROGRAM_CHANGE || message == MIDI_MESSAGE_CHANNEL_PRESSURE) ? 2 : 3;
+          uint32_t needed = status + ((message == MIDI_MESSAGE_PROGRAM_CHANGE || message == MIDI_MESSAGE_CHANNEL_PRESSURE) ? 1 : 2);
           if(needed > len)
             goto out;
           if(message == MIDI_MESSAGE_CONTROL_CHANGE){
-            message = data[1];
+            message = data[status];
             if(message & 0x80)
-              return -1;
-            NEXT(message, 1, &data[2], MIDI_CHANNEL_1 + channel);
+              FAIL;
+            NEXT(message, 1, &data[status+1], MIDI_CHANNEL_1 + channel);
           }else{
-            NEXT(message, needed-1, data+1, MIDI_CHANNEL_1 + channel);
+            NEXT(message, needed-status, data+status, MIDI_CHANNEL_1 + channel);
           }
+          midi->running_status = type;
           len -= needed;
           data += needed;
           midi->state = PS_TIMING;
@@ -111,9 +124,11 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
             if(data[i] & 0x80)
               break;
           if(i == 32)
-            return -1;
+            FAIL;
           if(i == len && !eof)
             goto out;
+          if(type <= 0xF7)
+            midi->running_status = 0;
           NEXT(message, i-1, data+1, MIDI_CHANNEL_NONE);
           data += i;
           len  -= i;
@@ -128,13 +143,13 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
         uint32_t dlen = 0;
         int vlen = parse_variable_length_quantity(len, data, &dlen);
         if(vlen == -1)
-          return -1;
+          FAIL;
         if(vlen == 0)
           goto out;
         if(dlen > 254){
           midi->state = PS_SKIP;
-          len += vlen;
-          data -= vlen;
+          len  -= vlen;
+          data += vlen;
           midi->tmp = dlen;
         }else{
           if(len-vlen < dlen)
@@ -162,8 +177,21 @@ ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, cons
 
     }
 #undef NEXT
+#undef FAIL
   }
 
 out:
   return old_len - len;
 }
+
+ssize_t midi_event_parser_parse(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof){
+  size_t count;
+  const ssize_t ret = parse(midi, len, data, eof, 1, &midi->event, &count);
+  midi->got_event = count;
+  return ret;
+}
+
+ssize_t midi_event_parser_parse_batch(struct midi_event_parser* midi, size_t len, const uint8_t data[len], bool eof, size_t capacity, struct midi_event events[capacity], size_t* count){
+  midi->got_event = false;
+  return parse(midi, len, data, eof, capacity, events, count);
+}
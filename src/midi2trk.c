@@ -1,152 +1,177 @@
 #include <midi.h>
-#include <ringbuffer.h>
+#include <smf.h>
+#include <tokenizer.h>
+#include <midi_notes.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
 
-const char* note_name[] = {"c","c#","d","d#","e","f","f#","g","g#","a","a#","h"};
+// Number of events parsed at once
+#define EVENT_BATCH_SIZE 256
+// Division of raw track data, which has no header. At the default tempo, a tick is 2ms
+#define RAW_DIVISION 250
+// The times in the output are in microseconds
+#define TIME_UNITS_PER_SECOND 1000000
 
-struct note {
-  bool done;
-  enum midi_channel channel;
-  uint64_t time;
-  uint64_t duration;
-  uint8_t tone;
-  uint8_t velocity_start;
-  uint8_t velocity_end;
-};
+struct tempo_map tempo_map;
 
-unsigned note_count = 0, note_offset = 0;
-#define NOTE_INDEX_MASK 0xFF
-struct note note_list[NOTE_INDEX_MASK+1];
+// The notes are written in the order they start, once they and all notes before them ended
+struct midi_notes notes;
+// Time of the last event, notes which never ended last until then
+uint64_t end_time;
 
-bool start_note(enum midi_channel channel, uint64_t time, uint8_t tone, uint8_t velocity_start){
-  if(note_count >= sizeof(note_list)/sizeof(*note_list))
+// Writes the notes which ended, with flush also the ones which didn't
+static void write_notes(bool flush){
+  while(notes.first){
+    if(flush && !notes.first->done)
+      fprintf(stderr, "Note %s %d never ended\n", midi_key_name[notes.first->key % 12], midi_key_octave(notes.first->key));
+    struct midi_note*const note = midi_notes_next(&notes, flush, end_time);
+    if(!note)
+      break;
+    static uint64_t last_time = 0;
+    static uint64_t natural_duration = 0;
+    static unsigned notes_same_time = 0; // Note, this is only the ones starting at the same time, there may still be some active.
+    const uint64_t diff = note->time - last_time;
+    notes_same_time += 1;
+    if(diff){
+      printf(notes_same_time <= 1 ? " " : "\n");
+      notes_same_time = 0;
+      if(natural_duration == diff){
+        printf(">>");
+      }else{
+        printf(">> %llu", (long long unsigned)diff);
+      }
+      natural_duration = natural_duration > diff ? natural_duration - diff : 0;
+      last_time = note->time;
+    }
+    if(natural_duration < note->duration)
+      natural_duration = note->duration;
+    printf("\nn  %-2s %d  %4llu", midi_key_name[note->key % 12], midi_key_octave(note->key), (long long unsigned)note->duration);
+    midi_notes_free(&notes, note);
+  }
+}
+
+bool stop_note(enum midi_channel channel, uint64_t time, uint8_t tone, uint8_t velocity_end){
+  if(!midi_notes_stop(&notes, channel, time, tone, velocity_end))
     return false;
-  note_list[(note_offset + note_count++) & NOTE_INDEX_MASK] = (struct note){
-    .channel = channel,
-    .time = time,
-    .tone = tone,
-    .velocity_start = velocity_start,
-  };
+  write_notes(false);
   return true;
 }
 
-bool stop_note(enum midi_channel channel, uint64_t time, uint8_t tone, uint8_t velocity_end){
-  for(unsigned i=note_offset,n=note_offset+note_count; i<n; i++){
-    {
-      struct note*restrict const note = &note_list[i & NOTE_INDEX_MASK];
-      if(note->done || note->channel != channel || note->tone != tone)
-        continue;
-      note->done = true;
-      note->duration = time - note->time;
-      note->velocity_end = velocity_end;
-    }
-    while(note_count && note_list[note_offset & NOTE_INDEX_MASK].done){
-      struct note*restrict const note = &note_list[note_offset & NOTE_INDEX_MASK];
-      static uint64_t last_time = 0;
-      static uint64_t natural_duration = 0;
-      static unsigned notes_same_time = 0; // Note, this is only the ones starting at the same time, there may still be some active.
-      const uint64_t diff = note->time - last_time;
-      notes_same_time += 1;
-      if(diff){
-        printf(notes_same_time <= 1 ? " " : "\n");
-        notes_same_time = 0;
-        if(natural_duration == diff){
-          printf(">>");
-        }else{
-          printf(">> %llu", (long long unsigned)diff);
+static bool handle_event(const struct midi_event*restrict const e){
+  fprintf(stderr, "%u dispatch_midi_event 0x%02X %u %d %s\n", (unsigned)e->time, e->type, e->len, e->channel, lookup_midi_message(e->type));
+  const uint64_t time = tempo_map_scale(&tempo_map, tempo_map_next(&tempo_map, e->time), TIME_UNITS_PER_SECOND);
+  end_time = time;
+  switch(e->type){
+    case MIDI_MESSAGE_NOTE_ON_EVENT: {
+      if(e->len < 2){
+        fprintf(stderr, "Invalid MIDI note on message, expected at least 2 data bytes (the note and \"velocity\" (essentially gain/volume))\n");
+      }else{
+        fprintf(stderr, "  %d %d\n", ((uint8_t*)e->data)[0], ((uint8_t*)e->data)[1]);
+        // A note on without velocity is a note off, files use it so the running status doesn't change
+        if(!((uint8_t*)e->data)[1]){
+          if(!stop_note(e->channel, time, ((uint8_t*)e->data)[0], 64))
+            fprintf(stderr, "Note not found!\n");
+        }else if(!midi_notes_start(&notes, e->channel, time, ((uint8_t*)e->data)[0], ((uint8_t*)e->data)[1])){
+          return false;
         }
-        natural_duration = natural_duration > diff ? natural_duration - diff : 0;
-        last_time = note->time;
       }
-      if(natural_duration < note->duration)
-        natural_duration = note->duration;
-      printf("\nn  %-2s %d  %4u", note_name[note->tone % 12], note->tone/12-2, (unsigned)note->duration);
-      note_count -= 1;
-      note_offset += 1;
-    }
-    return true;
+    } break;
+    case MIDI_MESSAGE_NOTE_OFF_EVENT: {
+      if(e->len < 2)
+        fprintf(stderr, "Invalid MIDI note on message, expected at least 2 data bytes (the note and \"velocity\" (essentially gain/volume))\n");
+      if(e->len >= 1){
+        int note = ((uint8_t*)e->data)[0];
+        int velocity = e->len >= 2 ? ((uint8_t*)e->data)[1] : 127;
+        fprintf(stderr, "  %d %d\n", note, velocity);
+        if(!stop_note(e->channel, time, note, velocity)){
+          fprintf(stderr, "Note not found!\n");
+        }
+      }
+    } break;
+    default: break;
   }
-  return false;
+  return true;
 }
 
-int main(int argc, char* argv[]){
-  setbuf(stdout, 0);
-  puts(
-    ":tune c 4 261.63\n"
-    ":intonation equal\n"
-    ":speed 1\n"
-    ":tempo 2ms\n"
-    "\n"
-  );
-  struct ringbuffer* rb = ringbuffer_create();
-  if(!rb){
-    fprintf(stderr, "ringbuffer_create failed");
-    return 1;
-  }
+// Track data without the chunks of a standard MIDI file
+static bool convert_events(size_t size, const uint8_t data[size]){
   struct midi_event_parser mep = {
     .has_timing = true
   };
-  while(true){
-    while(true){
-      const struct buffer_wo wo = ringbuffer_get_write_buffer(rb);
-      if(!wo.length) break;
-      ssize_t s = read(0, wo.v, wo.length);
-      if(!s) break;
-      if(s == -1){
-        if(errno == EINTR)
-          continue;
-        perror("read failed");
-        return 1;
-      }
-      ringbuffer_commit(rb, s);
-    }
-    const struct buffer_ro ro = ringbuffer_get_read_buffer(rb);
-    ssize_t res = midi_event_parser_parse(&mep, ro.length, ro.v, !ro.length);
+  if(!tempo_map_init(&tempo_map, RAW_DIVISION))
+    return false;
+  bool ok = true;
+  for(size_t offset=0; ok && offset<size; ){
+    struct midi_event events[EVENT_BATCH_SIZE];
+    size_t count = 0;
+    ssize_t res = midi_event_parser_parse_batch(&mep, size - offset, data + offset, true, EVENT_BATCH_SIZE, events, &count);
     if(res < 0){
       fprintf(stderr, "midi_event_parser_parse failed\n");
-      return 1;
+      ok = false;
+      break;
     }
-    if(mep.got_event){
-      const struct midi_event*restrict const e = &mep.event;
-      fprintf(stderr, "%u dispatch_midi_event 0x%02X %u %d %s\n", (unsigned)mep.time, e->type, e->len, e->channel, lookup_midi_message(e->type));
-      switch(e->type){
-        case MIDI_MESSAGE_NOTE_ON_EVENT: {
-          if(e->len < 2){
-            fprintf(stderr, "Invalid MIDI note on message, expected at least 2 data bytes (the note and \"velocity\" (essentially gain/volume))\n");
-          }else{
-            fprintf(stderr, "  %d %d\n", ((uint8_t*)e->data)[0], ((uint8_t*)e->data)[1]);
-            if(!start_note(e->channel, mep.time, ((uint8_t*)e->data)[0], ((uint8_t*)e->data)[1])){
-              fprintf(stderr, "Note overflow! Channel %u Note %u\n", note_list[note_offset & NOTE_INDEX_MASK].channel, note_list[note_offset & NOTE_INDEX_MASK].tone);
-              return 1;
-            }
-          }
-        } break;
-        case MIDI_MESSAGE_NOTE_OFF_EVENT: {
-          if(e->len < 2)
-            fprintf(stderr, "Invalid MIDI note on message, expected at least 2 data bytes (the note and \"velocity\" (essentially gain/volume))\n");
-          if(e->len >= 1){
-            int note = ((uint8_t*)e->data)[0];
-            int velocity = e->len >= 2 ? ((uint8_t*)e->data)[1] : 127;
-            fprintf(stderr, "  %d %d\n", note, velocity);
-            if(!stop_note(e->channel, mep.time, ((uint8_t*)e->data)[0], ((uint8_t*)e->data)[1])){
-              fprintf(stderr, "Note not found!\n");
-            }
-          }
-        } break;
-        default: break;
+    for(size_t i=0; ok && i<count; i++){
+      // The events arrive in order, so the tempo map is complete up to each of them
+      const struct midi_event*const e = &events[i];
+      if(e->type == MIDI_MESSAGE_META_SET_TEMPO && e->len == 3){
+        const uint8_t*const d = e->data;
+        ok = tempo_map_add(&tempo_map, e->time, (uint32_t)d[0] << 16 | d[1] << 8 | d[2]);
       }
+      ok = ok && handle_event(e);
     }
-    if(!ro.length) break;
-    if(!res){
+    if(ok && !res){
       fprintf(stderr, "midi_event_parser_parse failed to progress\n");
-      return 1;
+      ok = false;
     }
-    ringbuffer_discard(rb, res);
+    offset += res;
   }
+  tempo_map_destroy(&tempo_map);
+  return ok;
+}
+
+static bool convert_smf(size_t size, const uint8_t data[size]){
+  struct smf smf;
+  if(smf_parse(&smf, size, data))
+    return false;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct smf_merge merge;
+  bool ok = !smf_decode(&smf, threads > 0 ? threads : 1) && smf_tempo_map(&smf, &tempo_map);
+  if(ok && (ok = smf_merge_init(&merge, &smf))){
+    for(const struct midi_event* e; ok && (e = smf_merge_next(&merge)); )
+      ok = handle_event(e);
+    smf_merge_destroy(&merge);
+  }
+  tempo_map_destroy(&tempo_map);
+  smf_destroy(&smf);
+  return ok;
+}
+
+int main(int argc, char* argv[]){
+  (void)argc;
+  (void)argv;
+  setbuf(stdout, 0);
+  puts(
+    ":tune c 4 261.6\n"
+    ":intonation equal\n"
+    ":speed 1\n"
+    ":tempo 0.001ms\n"
+    "\n"
+  );
+  struct source source;
+  if(source_open(&source, 0))
+    return 1;
+  midi_notes_init(&notes);
+  const uint8_t*const data = (const uint8_t*)source.data;
+  const bool ok = smf_is(source.size, data) ? convert_smf(source.size, data) : convert_events(source.size, data);
+  if(ok)
+    write_notes(true);
+  source_close(&source);
+  midi_notes_destroy(&notes);
+  if(!ok)
+    return 1;
   printf("\n");
-  ringbuffer_destroy(rb);
   return 0;
 }
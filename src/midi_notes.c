@@ -0,0 +1,68 @@
+#include <midi_notes.h>
+#include <string.h>
+
+const char*const midi_key_name[12] = {"c","c#","d","d#","e","f","f#","g","g#","a","a#","h"};
+
+void midi_notes_init(struct midi_notes* notes){
+  notes->first = notes->last = 0;
+  memset(notes->active, 0, sizeof(notes->active));
+  pool_init(&notes->pool, sizeof(struct midi_note), 1024);
+}
+
+static struct midi_note_queue* midi_notes_queue(struct midi_notes* notes, enum midi_channel channel, uint8_t key){
+  return &notes->active[(channel - MIDI_CHANNEL_1) % MIDI_CHANNEL_COUNT][key % MIDI_KEY_COUNT];
+}
+
+bool midi_notes_start(struct midi_notes* notes, enum midi_channel channel, uint64_t time, uint8_t key, uint8_t velocity){
+  struct midi_note*const note = pool_alloc(&notes->pool);
+  if(!note)
+    return false;
+  *note = (struct midi_note){
+    .channel = channel,
+    .time = time,
+    .key = key,
+    .velocity_start = velocity,
+  };
+  *(notes->last ? &notes->last->next : &notes->first) = note;
+  notes->last = note;
+  struct midi_note_queue*const queue = midi_notes_queue(notes, channel, key);
+  *(queue->last ? &queue->last->next_same_key : &queue->first) = note;
+  queue->last = note;
+  return true;
+}
+
+bool midi_notes_stop(struct midi_notes* notes, enum midi_channel channel, uint64_t time, uint8_t key, uint8_t velocity){
+  struct midi_note_queue*const queue = midi_notes_queue(notes, channel, key);
+  struct midi_note*const stopped = queue->first;
+  if(!stopped)
+    return false;
+  queue->first = stopped->next_same_key;
+  if(!queue->first)
+    queue->last = 0;
+  stopped->done = true;
+  stopped->duration = time - stopped->time;
+  stopped->velocity_end = velocity;
+  return true;
+}
+
+struct midi_note* midi_notes_next(struct midi_notes* notes, bool flush, uint64_t time){
+  struct midi_note*const note = notes->first;
+  if(!note)
+    return 0;
+  // The first note started before all others, so it is also the first active one of its key
+  if(!note->done && (!flush || !midi_notes_stop(notes, note->channel, time, note->key, 0)))
+    return 0;
+  notes->first = note->next;
+  if(!notes->first)
+    notes->last = 0;
+  return note;
+}
+
+void midi_notes_free(struct midi_notes* notes, struct midi_note* note){
+  pool_free(&notes->pool, note);
+}
+
+void midi_notes_destroy(struct midi_notes* notes){
+  pool_destroy(&notes->pool);
+  notes->first = notes->last = 0;
+}
@@ -0,0 +1,287 @@
+#include <oscillator.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#ifdef OSCILLATOR_X86
+#include <immintrin.h>
+#endif
+
+#ifndef M_PIl
+#define M_PIl 3.141592653589793238462643383279502884L
+#endif
+
+const char*const waveform_name[WAVEFORM_COUNT] = {
+#define X(N, S) [N] = S,
+  WAVEFORMS
+#undef X
+};
+
+int16_t sg_sin(long double f){
+  return sinl(2 * M_PIl * f) * 0x7FFFu;
+}
+
+int16_t sg_triangle(long double f){
+  const long double x = f < 0.25 ? 4 * f : f < 0.75 ? 2 - 4 * f : 4 * f - 4;
+  return x * 0x7FFF;
+}
+
+int16_t sg_square(long double f){
+  return f > 0.5 ? 0x7FFF : -0x7FFF;
+}
+
+static void exact_render(sample_generator_t* sg, size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment)
+    out[i] = sg((long double)phase / 0x100000000);
+}
+
+static void exact_sin(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  exact_render(sg_sin, n, out, phase, increment);
+}
+
+static void exact_triangle(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  exact_render(sg_triangle, n, out, phase, increment);
+}
+
+static void exact_square(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  exact_render(sg_square, n, out, phase, increment);
+}
+
+const struct oscillator oscillator_exact = {
+  .name = "exact",
+  .kernel = {
+    [WAVEFORM_SIN] = exact_sin,
+    [WAVEFORM_TRIANGLE] = exact_triangle,
+    [WAVEFORM_SQUARE] = exact_square,
+  },
+};
+
+/*
+ * All the approximations work the same way. The phase is taken as a signed value, x = phase / 2^32 in [-0.5, 0.5).
+ * Using the symmetry of the waveforms, it's folded into u = 4 * x in [-1, 1] for |x| <= 0.25, and
+ * u = 4 * (±0.5 - x) otherwise. u is already the triangle wave, and sin(pi/2 * u) is approximated with an odd
+ * polynomial of degree 7. Its coefficients were fitted for a minimal maximum error, which is 5.9e-7,
+ * or 7.4e-7 when evaluated in float precision.
+ * The vector versions do exactly the same operations in the same order, so the results are identical.
+ */
+#define SIN_C1  1.5707910060882568f
+#define SIN_C3 -0.645892858505249f
+#define SIN_C5  0.0794343426823616f
+#define SIN_C7 -0.004333095159381628f
+
+static inline float fold(uint32_t phase){
+  const float x = (int32_t)phase * 0x1p-32f;
+  const float a = fabsf(x);
+  const float m = fminf(a, 0.5f - a);
+  const float u = m * 4.0f;
+  return x < 0 ? -u : u;
+}
+
+static inline float poly_sin(float u){
+  const float u2 = u * u;
+  float p = SIN_C7;
+  p = p * u2 + SIN_C5;
+  p = p * u2 + SIN_C3;
+  p = p * u2 + SIN_C1;
+  return p * u;
+}
+
+static void scalar_sin(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment)
+    out[i] = (int32_t)(poly_sin(fold(phase)) * 32767.0f);
+}
+
+static void scalar_triangle(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment)
+    out[i] = (int32_t)(fold(phase) * 32767.0f);
+}
+
+static void scalar_square(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment)
+    out[i] = phase > 0x80000000u ? 0x7FFF : -0x7FFF;
+}
+
+const struct oscillator oscillator_scalar = {
+  .name = "scalar",
+  .kernel = {
+    [WAVEFORM_SIN] = scalar_sin,
+    [WAVEFORM_TRIANGLE] = scalar_triangle,
+    [WAVEFORM_SQUARE] = scalar_square,
+  },
+};
+
+#ifdef OSCILLATOR_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+SSE2 static inline __m128i sse2_phase(uint32_t phase, uint32_t increment){
+  return _mm_add_epi32(_mm_set1_epi32(phase), _mm_set_epi32(increment*3, increment*2, increment, 0));
+}
+
+SSE2 static inline __m128 sse2_fold(__m128i phase){
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(phase), _mm_set1_ps(0x1p-32f));
+  const __m128 a = _mm_andnot_ps(sign, x);
+  const __m128 m = _mm_min_ps(a, _mm_sub_ps(_mm_set1_ps(0.5f), a));
+  return _mm_or_ps(_mm_mul_ps(m, _mm_set1_ps(4.0f)), _mm_and_ps(sign, x));
+}
+
+SSE2 static inline __m128 sse2_poly_sin(__m128 u){
+  const __m128 u2 = _mm_mul_ps(u, u);
+  __m128 p = _mm_set1_ps(SIN_C7);
+  p = _mm_add_ps(_mm_mul_ps(p, u2), _mm_set1_ps(SIN_C5));
+  p = _mm_add_ps(_mm_mul_ps(p, u2), _mm_set1_ps(SIN_C3));
+  p = _mm_add_ps(_mm_mul_ps(p, u2), _mm_set1_ps(SIN_C1));
+  return _mm_mul_ps(p, u);
+}
+
+SSE2 static inline void sse2_store(int16_t* out, __m128i x){
+  _mm_storel_epi64((__m128i*)out, _mm_packs_epi32(x, x));
+}
+
+SSE2 static void sse2_sin(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m128i p = sse2_phase(phase, increment);
+  const __m128i step = _mm_set1_epi32(increment * 4);
+  size_t i = 0;
+  for(; i+4<=n; i+=4, p=_mm_add_epi32(p, step))
+    sse2_store(&out[i], _mm_cvttps_epi32(_mm_mul_ps(sse2_poly_sin(sse2_fold(p)), _mm_set1_ps(32767.0f))));
+  scalar_sin(n-i, out+i, phase+increment*i, increment);
+}
+
+SSE2 static void sse2_triangle(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m128i p = sse2_phase(phase, increment);
+  const __m128i step = _mm_set1_epi32(increment * 4);
+  size_t i = 0;
+  for(; i+4<=n; i+=4, p=_mm_add_epi32(p, step))
+    sse2_store(&out[i], _mm_cvttps_epi32(_mm_mul_ps(sse2_fold(p), _mm_set1_ps(32767.0f))));
+  scalar_triangle(n-i, out+i, phase+increment*i, increment);
+}
+
+SSE2 static void sse2_square(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m128i p = sse2_phase(phase, increment);
+  const __m128i step = _mm_set1_epi32(increment * 4);
+  const __m128i flip = _mm_set1_epi32(0x80000000u);
+  size_t i = 0;
+  for(; i+4<=n; i+=4, p=_mm_add_epi32(p, step)){
+    // phase > 0x80000000 unsigned is phase ^ 0x80000000 > 0 signed
+    const __m128i m = _mm_cmpgt_epi32(_mm_xor_si128(p, flip), _mm_setzero_si128());
+    sse2_store(&out[i], _mm_add_epi32(_mm_set1_epi32(-0x7FFF), _mm_and_si128(m, _mm_set1_epi32(0xFFFE))));
+  }
+  scalar_square(n-i, out+i, phase+increment*i, increment);
+}
+
+const struct oscillator oscillator_sse2 = {
+  .name = "sse2",
+  .kernel = {
+    [WAVEFORM_SIN] = sse2_sin,
+    [WAVEFORM_TRIANGLE] = sse2_triangle,
+    [WAVEFORM_SQUARE] = sse2_square,
+  },
+};
+
+AVX2 static inline __m256i avx2_phase(uint32_t phase, uint32_t increment){
+  return _mm256_add_epi32(_mm256_set1_epi32(phase), _mm256_set_epi32(
+    increment*7, increment*6, increment*5, increment*4,
+    increment*3, increment*2, increment, 0
+  ));
+}
+
+AVX2 static inline __m256 avx2_fold(__m256i phase){
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(phase), _mm256_set1_ps(0x1p-32f));
+  const __m256 a = _mm256_andnot_ps(sign, x);
+  const __m256 m = _mm256_min_ps(a, _mm256_sub_ps(_mm256_set1_ps(0.5f), a));
+  return _mm256_or_ps(_mm256_mul_ps(m, _mm256_set1_ps(4.0f)), _mm256_and_ps(sign, x));
+}
+
+AVX2 static inline __m256 avx2_poly_sin(__m256 u){
+  const __m256 u2 = _mm256_mul_ps(u, u);
+  __m256 p = _mm256_set1_ps(SIN_C7);
+  p = _mm256_add_ps(_mm256_mul_ps(p, u2), _mm256_set1_ps(SIN_C5));
+  p = _mm256_add_ps(_mm256_mul_ps(p, u2), _mm256_set1_ps(SIN_C3));
+  p = _mm256_add_ps(_mm256_mul_ps(p, u2), _mm256_set1_ps(SIN_C1));
+  return _mm256_mul_ps(p, u);
+}
+
+AVX2 static inline void avx2_store(int16_t* out, __m256i x){
+  const __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+  _mm_storeu_si128((__m128i*)out, packed);
+}
+
+AVX2 static void avx2_sin(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m256i p = avx2_phase(phase, increment);
+  const __m256i step = _mm256_set1_epi32(increment * 8);
+  size_t i = 0;
+  for(; i+8<=n; i+=8, p=_mm256_add_epi32(p, step))
+    avx2_store(&out[i], _mm256_cvttps_epi32(_mm256_mul_ps(avx2_poly_sin(avx2_fold(p)), _mm256_set1_ps(32767.0f))));
+  scalar_sin(n-i, out+i, phase+increment*i, increment);
+}
+
+AVX2 static void avx2_triangle(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m256i p = avx2_phase(phase, increment);
+  const __m256i step = _mm256_set1_epi32(increment * 8);
+  size_t i = 0;
+  for(; i+8<=n; i+=8, p=_mm256_add_epi32(p, step))
+    avx2_store(&out[i], _mm256_cvttps_epi32(_mm256_mul_ps(avx2_fold(p), _mm256_set1_ps(32767.0f))));
+  scalar_triangle(n-i, out+i, phase+increment*i, increment);
+}
+
+AVX2 static void avx2_square(size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  __m256i p = avx2_phase(phase, increment);
+  const __m256i step = _mm256_set1_epi32(increment * 8);
+  const __m256i flip = _mm256_set1_epi32(0x80000000u);
+  size_t i = 0;
+  for(; i+8<=n; i+=8, p=_mm256_add_epi32(p, step)){
+    const __m256i m = _mm256_cmpgt_epi32(_mm256_xor_si256(p, flip), _mm256_setzero_si256());
+    avx2_store(&out[i], _mm256_add_epi32(_mm256_set1_epi32(-0x7FFF), _mm256_and_si256(m, _mm256_set1_epi32(0xFFFE))));
+  }
+  scalar_square(n-i, out+i, phase+increment*i, increment);
+}
+
+const struct oscillator oscillator_avx2 = {
+  .name = "avx2",
+  .kernel = {
+    [WAVEFORM_SIN] = avx2_sin,
+    [WAVEFORM_TRIANGLE] = avx2_triangle,
+    [WAVEFORM_SQUARE] = avx2_square,
+  },
+};
+
+#endif
+
+static bool oscillator_supported(const struct oscillator* oscillator){
+#ifdef OSCILLATOR_X86
+  __builtin_cpu_init();
+  if(oscillator == &oscillator_sse2)
+    return __builtin_cpu_supports("sse2");
+  if(oscillator == &oscillator_avx2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  (void)oscillator;
+  return true;
+}
+
+static const struct oscillator*const oscillator_list[] = {
+  // Preferred ones first
+#ifdef OSCILLATOR_X86
+  &oscillator_avx2,
+  &oscillator_sse2,
+#endif
+  &oscillator_scalar,
+  &oscillator_exact,
+};
+
+const struct oscillator* oscillator_lookup(const char* name){
+  const bool any = !strcmp(name, "auto");
+  for(size_t i=0; i<sizeof(oscillator_list)/sizeof(*oscillator_list); i++){
+    const struct oscillator* oscillator = oscillator_list[i];
+    if(!any && strcmp(oscillator->name, name))
+      continue;
+    if(!oscillator_supported(oscillator)){
+      if(any) continue;
+      return 0;
+    }
+    return oscillator;
+  }
+  return 0;
+}
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <output.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <assert.h>
+
+static int writev_all(int fd, struct iovec* iov, int count){
+  while(count){
+    ssize_t s = writev(fd, iov, count);
+    if(s == -1){
+      if(errno == EINTR)
+        continue;
+      fprintf(stderr, "%s:%u: writev failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return -1;
+    }
+    // Partial write, skip what was already written
+    while(count && (size_t)s >= iov->iov_len){
+      s -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count){
+      iov->iov_base = (char*)iov->iov_base + s;
+      iov->iov_len -= s;
+    }
+  }
+  return 0;
+}
+
+int write_all(int fd, size_t len, const void* data){
+  struct iovec iov = { .iov_base = (void*)data, .iov_len = len };
+  return writev_all(fd, &iov, 1);
+}
+
+static int output_unmap(struct output* out){
+  if(!out->map)
+    return 0;
+  if(munmap(out->map, out->map_size) == -1){
+    fprintf(stderr, "%s:%u: munmap failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  out->map = 0;
+  return 0;
+}
+
+// Give up on mapping the file, and continue with normal writes from the current position
+static int output_fallback(struct output* out){
+  if(output_unmap(out))
+    return -1;
+  out->mapped = false;
+  if(ftruncate(out->fd, out->position) == -1 || lseek(out->fd, out->position, SEEK_SET) == -1){
+    fprintf(stderr, "%s:%u: ftruncate / lseek failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  if(!out->buffer){
+    out->buffer = malloc(out->block_size);
+    if(!out->buffer){
+      fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int output_remap(struct output* out){
+  if(output_unmap(out))
+    return -1;
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = OUTPUT_MAP_WINDOW;
+  if(size < out->block_size + page_size)
+    size = (out->block_size + page_size * 2 - 1) / page_size * page_size;
+  const off_t offset = out->position / page_size * page_size;
+  // Allocate the space first, running out of disk space in a mapping would be a SIGBUS instead of an error
+  int ret = fallocate(out->map_fd, 0, offset, size);
+  if(ret == -1 && (errno == EOPNOTSUPP || errno == ENOSYS))
+    ret = ftruncate(out->map_fd, offset + size);
+  if(ret == -1){
+    fprintf(stderr, "%s:%u: fallocate failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return output_fallback(out);
+  }
+  void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, out->map_fd, offset);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "%s:%u: mmap failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return output_fallback(out);
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  out->map = map;
+  out->map_offset = offset;
+  out->map_size = size;
+  return 0;
+}
+
+int output_init(struct output* out, int fd, size_t block_size, bool allow_mmap){
+  if(block_size < OUTPUT_MIN_BLOCK_SIZE)
+    block_size = OUTPUT_MIN_BLOCK_SIZE;
+  if(block_size > OUTPUT_MAX_BLOCK_SIZE)
+    block_size = OUTPUT_MAX_BLOCK_SIZE;
+  *out = (struct output){
+    .fd = fd,
+    .map_fd = -1,
+    .block_size = block_size,
+  };
+  if(allow_mmap){
+    struct stat st;
+    const int flags = fcntl(fd, F_GETFL);
+    if( fstat(fd, &st) != -1 && S_ISREG(st.st_mode)
+     && flags != -1 && (flags & O_ACCMODE) != O_RDONLY && !(flags & O_APPEND)
+    ){
+      out->position = lseek(fd, 0, SEEK_CUR);
+      if((flags & O_ACCMODE) == O_RDWR){
+        out->map_fd = fd;
+      }else{
+        // A shell redirect opens the file write only, but a shared mapping needs it to be readable too
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        out->map_fd = open(path, O_RDWR | O_CLOEXEC);
+      }
+      if(out->position != -1 && out->map_fd != -1)
+        out->mapped = true;
+    }
+  }
+  if(!out->mapped){
+    out->buffer = malloc(block_size);
+    if(!out->buffer){
+      fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void* output_reserve(struct output* out, size_t len){
+  if(out->mapped){
+    if(!out->map || (size_t)(out->position - out->map_offset) + len > out->map_size)
+      if(output_remap(out))
+        return 0;
+    if(out->mapped)
+      return out->map + (out->position - out->map_offset);
+  }
+  if(out->fill + len > out->block_size)
+    if(output_flush(out))
+      return 0;
+  return out->buffer + out->fill;
+}
+
+void output_commit(struct output* out, size_t len){
+  if(out->mapped){
+    out->position += len;
+  }else{
+    out->fill += len;
+  }
+}
+
+int output_write(struct output* out, size_t len, const void* data){
+  if(!out->mapped && out->fill + len > out->block_size){
+    struct iovec iov[] = {
+      { .iov_base = out->buffer, .iov_len = out->fill },
+      { .iov_base = (void*)data, .iov_len = len },
+    };
+    out->fill = 0;
+    return writev_all(out->fd, iov, 2);
+  }
+  while(len){
+    const size_t n = len < out->block_size ? len : out->block_size;
+    void* dst = output_reserve(out, n);
+    if(!dst)
+      return -1;
+    memcpy(dst, data, n);
+    output_commit(out, n);
+    data = (const char*)data + n;
+    len -= n;
+  }
+  return 0;
+}
+
+int output_flush(struct output* out){
+  if(out->mapped || !out->fill)
+    return 0;
+  const size_t fill = out->fill;
+  out->fill = 0;
+  return write_all(out->fd, fill, out->buffer);
+}
+
+int output_sync(struct output* out){
+  if(output_flush(out))
+    return -1;
+  // Pages written through the mapping are flushed along with the file
+  if(fdatasync(out->mapped ? out->map_fd : out->fd) == -1){
+    fprintf(stderr, "%s:%u: fdatasync failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int output_close(struct output* out){
+  int ret = output_flush(out);
+  if(out->mapped){
+    if(output_unmap(out))
+      ret = -1;
+    // Cut off the part of the last window which wasn't used, and leave the file offset where a write would have
+    if(ftruncate(out->fd, out->position) == -1 || lseek(out->fd, out->position, SEEK_SET) == -1){
+      fprintf(stderr, "%s:%u: ftruncate / lseek failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      ret = -1;
+    }
+  }
+  if(out->map_fd != -1 && out->map_fd != out->fd)
+    close(out->map_fd);
+  out->map_fd = -1;
+  free(out->buffer);
+  out->buffer = 0;
+  return ret;
+}
+
+const char*const output_format_name[OUTPUT_FORMAT_COUNT] = {
+#define X(N, S) [N] = S,
+  OUTPUT_FORMATS
+#undef X
+};
+
+size_t output_sample_size(enum output_format format){
+  switch(format){
+    case F_FLOAT_64: return 8;
+    case F_FLOAT_32: return 4;
+    case F_INT_32: return 4;
+    case F_INT_24: return 3;
+    case F_INT_16: return 2;
+    case OUTPUT_FORMAT_COUNT: break;
+  }
+  return 4;
+}
+
+int64_t output_quantum(enum output_format format){
+  switch(format){
+    case F_FLOAT_64: case F_FLOAT_32: return 0;
+    case F_INT_32: return 1;
+    case F_INT_24: return 1 << 8;
+    case F_INT_16: return 1 << 16;
+    case OUTPUT_FORMAT_COUNT: break;
+  }
+  return 1;
+}
+
+/*
+ * The conversion kernels work on blocks of up to OUTPUT_KERNEL_BLOCK samples, which are converted into an aligned
+ * buffer first, and then copied to the output, which may not be aligned.
+ */
+#define OUTPUT_KERNEL_BLOCK 256
+
+typedef void output_kernel_t(size_t n, const int64_t mix[restrict n], unsigned char* restrict out);
+
+/*
+ * Rounds a sample to an integer format with 32 - shift bits, and clips it to +-max.
+ * The sample is clipped first, to the range which rounds to +-max, so everything after that fits into 32 bits.
+ */
+#define INT_CLIP_MIN(shift, max) (-((int64_t)(max) << (shift)) - ((1 << (shift)) >> 1))
+#define INT_CLIP_MAX(shift, max) (((int64_t)(max) << (shift)) + ((1 << (shift)) >> 1) - ((shift) ? 1 : 0))
+
+static inline int32_t int_round(int64_t sample, unsigned shift, int32_t max){
+  if(sample < INT_CLIP_MIN(shift, max))
+    sample = INT_CLIP_MIN(shift, max);
+  if(sample > INT_CLIP_MAX(shift, max))
+    sample = INT_CLIP_MAX(shift, max);
+  const int32_t s = sample;
+  return (s + ((1 << shift) >> 1)) >> shift;
+}
+
+static void scalar_float64(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  double buffer[OUTPUT_KERNEL_BLOCK];
+  static_assert(sizeof(*buffer) == 8, "float64 has to be a double");
+  for(size_t i=0; i<n; i++)
+    buffer[i] = mix[i] * 0x1p-31;
+  memcpy(out, buffer, n * sizeof(*buffer));
+}
+
+static void scalar_float32(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  float buffer[OUTPUT_KERNEL_BLOCK];
+  static_assert(sizeof(*buffer) == 4, "float32 has to be a float");
+  for(size_t i=0; i<n; i++)
+    buffer[i] = mix[i] * 0x1p-31;
+  memcpy(out, buffer, n * sizeof(*buffer));
+}
+
+static void scalar_int32(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  int32_t buffer[OUTPUT_KERNEL_BLOCK];
+  for(size_t i=0; i<n; i++)
+    buffer[i] = int_round(mix[i], 0, 0x7FFFFFFF);
+  memcpy(out, buffer, n * sizeof(*buffer));
+}
+
+static void scalar_int24(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  for(size_t i=0; i<n; i++,out+=3){
+    const uint32_t sample = int_round(mix[i], 8, 0x7FFFFF);
+    out[0] = sample;
+    out[1] = sample >> 8;
+    out[2] = sample >> 16;
+  }
+}
+
+static void scalar_int16(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  int16_t buffer[OUTPUT_KERNEL_BLOCK];
+  for(size_t i=0; i<n; i++)
+    buffer[i] = int_round(mix[i], 16, 0x7FFF);
+  memcpy(out, buffer, n * sizeof(*buffer));
+}
+
+static output_kernel_t*const scalar_kernel[OUTPUT_FORMAT_COUNT] = {
+  [F_FLOAT_64] = scalar_float64,
+  [F_FLOAT_32] = scalar_float32,
+  [F_INT_32] = scalar_int32,
+  [F_INT_24] = scalar_int24,
+  [F_INT_16] = scalar_int16,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OUTPUT_X86
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Clips 4 samples like int_round, and narrows them to 32 bits
+AVX2 static inline __m128i avx2_clip(const int64_t* mix, __m256i min, __m256i max){
+  __m256i x = _mm256_loadu_si256((const __m256i*)mix);
+  x = _mm256_blendv_epi8(x, min, _mm256_cmpgt_epi64(min, x));
+  x = _mm256_blendv_epi8(x, max, _mm256_cmpgt_epi64(x, max));
+  x = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+  return _mm256_castsi256_si128(x);
+}
+
+AVX2 static void avx2_int32(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  const __m256i min = _mm256_set1_epi64x(INT_CLIP_MIN(0, 0x7FFFFFFF));
+  const __m256i max = _mm256_set1_epi64x(INT_CLIP_MAX(0, 0x7FFFFFFF));
+  size_t i = 0;
+  for(; i+4<=n; i+=4)
+    _mm_storeu_si128((__m128i*)(out + i * 4), avx2_clip(mix + i, min, max));
+  scalar_int32(n - i, mix + i, out + i * 4);
+}
+
+AVX2 static void avx2_int16(size_t n, const int64_t mix[restrict n], unsigned char* restrict out){
+  const __m256i min = _mm256_set1_epi64x(INT_CLIP_MIN(16, 0x7FFF));
+  const __m256i max = _mm256_set1_epi64x(INT_CLIP_MAX(16, 0x7FFF));
+  const __m128i half = _mm_set1_epi32(0x8000);
+  size_t i = 0;
+  for(; i+8<=n; i+=8){
+    const __m128i a = _mm_srai_epi32(_mm_add_epi32(avx2_clip(mix + i, min, max), half), 16);
+    const __m128i b = _mm_srai_epi32(_mm_add_epi32(avx2_clip(mix + i + 4, min, max), half), 16);
+    _mm_storeu_si128((__m128i*)(out + i * 2), _mm_packs_epi32(a, b));
+  }
+  scalar_int16(n - i, mix + i, out + i * 2);
+}
+
+static output_kernel_t*const avx2_kernel[OUTPUT_FORMAT_COUNT] = {
+  [F_FLOAT_64] = scalar_float64,
+  [F_FLOAT_32] = scalar_float32,
+  [F_INT_32] = avx2_int32,
+  [F_INT_24] = scalar_int24,
+  [F_INT_16] = avx2_int16,
+};
+
+#endif
+
+void output_convert(enum output_format format, size_t n, const int64_t mix[n], void* out){
+  output_kernel_t* kernel = scalar_kernel[format];
+#ifdef OUTPUT_X86
+  if(__builtin_cpu_supports("avx2"))
+    kernel = avx2_kernel[format];
+#endif
+  const size_t size = output_sample_size(format);
+  for(size_t i=0; i<n; i+=OUTPUT_KERNEL_BLOCK){
+    const size_t count = n - i < OUTPUT_KERNEL_BLOCK ? n - i : OUTPUT_KERNEL_BLOCK;
+    kernel(count, mix + i, (unsigned char*)out + i * size);
+  }
+}
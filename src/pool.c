@@ -0,0 +1,86 @@
+#include <pool.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+struct pool_slab {
+  struct pool_slab* next;
+  alignas(max_align_t) char data[];
+};
+
+void pool_init(struct pool* pool, size_t item_size, size_t slab_items){
+  // Items need to hold the free list pointer, and need to be suitably aligned
+  if(item_size < sizeof(void*))
+    item_size = sizeof(void*);
+  item_size = (item_size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+  *pool = (struct pool){
+    .item_size = item_size,
+    .slab_items = slab_items ? slab_items : 1,
+  };
+}
+
+static int pool_grow(struct pool* pool, size_t count){
+  // Grow geometrically, so the number of slabs stays logarithmic
+  if(count < pool->slab_items)
+    count = pool->slab_items;
+  if(count < pool->capacity)
+    count = pool->capacity;
+  struct pool_slab* slab = malloc(sizeof(*slab) + pool->item_size * count);
+  if(!slab){
+    fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  // Whatever is left of the previous slab goes into the free list
+  while(pool->unused < pool->unused_end){
+    *(void**)pool->unused = pool->free_list;
+    pool->free_list = pool->unused;
+    pool->unused += pool->item_size;
+  }
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->unused = slab->data;
+  pool->unused_end = slab->data + pool->item_size * count;
+  pool->capacity += count;
+  return 0;
+}
+
+int pool_reserve(struct pool* pool, size_t count){
+  if(pool->used + count <= pool->capacity)
+    return 0;
+  return pool_grow(pool, pool->used + count - pool->capacity);
+}
+
+void* pool_alloc(struct pool* pool){
+  void* item = pool->free_list;
+  if(item){
+    pool->free_list = *(void**)item;
+  }else{
+    if(pool->unused >= pool->unused_end)
+      if(pool_grow(pool, 0))
+        return 0;
+    item = pool->unused;
+    pool->unused += pool->item_size;
+  }
+  if(++pool->used > pool->high_water)
+    pool->high_water = pool->used;
+  return item;
+}
+
+void pool_free(struct pool* pool, void* item){
+  if(!item)
+    return;
+  *(void**)item = pool->free_list;
+  pool->free_list = item;
+  pool->used -= 1;
+}
+
+void pool_destroy(struct pool* pool){
+  for(struct pool_slab *it=pool->slabs, *next; it; it=next){
+    next = it->next;
+    free(it);
+  }
+  *pool = (struct pool){0};
+}
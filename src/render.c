@@ -0,0 +1,687 @@
+#define _GNU_SOURCE
+#include <render.h>
+#include <checkpoint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+bool timeline_reserve(struct timeline* t, size_t count){
+  if(t->count + count <= t->capacity)
+    return true;
+  size_t capacity = t->capacity ? t->capacity * 2 : 1024;
+  if(capacity < t->count + count)
+    capacity = t->count + count;
+  struct voice* v = realloc(t->voice, sizeof(*v) * capacity);
+  if(v)
+    t->voice = v;
+  uint64_t* end_max = v ? realloc(t->end_max, sizeof(*end_max) * capacity) : 0;
+  if(!end_max){
+    fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  t->end_max = end_max;
+  t->capacity = capacity;
+  return true;
+}
+
+bool timeline_add(struct timeline* t, const struct voice* voice){
+  assert(!t->count || t->voice[t->count-1].start <= voice->start);
+  if(!timeline_reserve(t, 1))
+    return false;
+  const uint64_t end = voice->start + voice->duration;
+  t->end_max[t->count] = t->count && t->end_max[t->count-1] > end ? t->end_max[t->count-1] : end;
+  t->voice[t->count++] = *voice;
+  // A voice is removed one sample after it ended, until then, there is something left to render
+  if(t->end < voice->start + voice->duration + 1)
+    t->end = voice->start + voice->duration + 1;
+  return true;
+}
+
+uint64_t timeline_advance(struct timeline* t, uint64_t time){
+  const uint64_t remaining = t->end > t->length ? t->end - t->length : 0;
+  if(time > remaining)
+    time = remaining;
+  t->length += time;
+  return time;
+}
+
+void timeline_destroy(struct timeline* t){
+  free(t->voice);
+  free(t->end_max);
+  *t = (struct timeline){0};
+}
+
+static bool voices_reserve(struct voices* v, size_t count){
+  if(v->count + count <= v->capacity)
+    return true;
+  size_t capacity = v->capacity ? v->capacity * 2 : RENDER_DEFAULT_VOICES;
+  if(capacity < v->count + count)
+    capacity = v->count + count;
+#define GROW(F) { \
+    void* f = realloc(v->F, sizeof(*v->F) * capacity); \
+    if(!f){ \
+      fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno)); \
+      return false; \
+    } \
+    v->F = f; \
+  }
+  GROW(time)
+  GROW(duration)
+  GROW(gate)
+  GROW(phase)
+  GROW(increment)
+  GROW(waveform)
+  GROW(table)
+  GROW(envelope)
+  GROW(amplitude)
+#undef GROW
+  v->capacity = capacity;
+  return true;
+}
+
+// Adds a voice of the timeline, which has been playing for the given time already
+static bool voices_add(struct voices* v, const struct voice* voice, uint64_t time){
+  if(!voices_reserve(v, 1))
+    return false;
+  const size_t i = v->count++;
+  v->time[i] = time;
+  v->duration[i] = voice->duration;
+  v->gate[i] = voice->gate;
+  v->phase[i] = voice->phase + (uint32_t)(voice->increment * time);
+  v->increment[i] = voice->increment;
+  v->waveform[i] = voice->waveform;
+  v->table[i] = voice->table;
+  v->envelope[i] = voice->envelope;
+  v->amplitude[i] = voice->amplitude;
+  if(v->high_water < v->count)
+    v->high_water = v->count;
+  return true;
+}
+
+// Removes the voices which have ended, filling the gaps with the voices from the end
+static void voices_remove_ended(struct voices* v){
+  for(size_t i=0; i<v->count; ){
+    if(v->time[i] < v->duration[i]){
+      i++;
+      continue;
+    }
+    const size_t last = --v->count;
+    v->time[i] = v->time[last];
+    v->duration[i] = v->duration[last];
+    v->gate[i] = v->gate[last];
+    v->phase[i] = v->phase[last];
+    v->increment[i] = v->increment[last];
+    v->waveform[i] = v->waveform[last];
+    v->table[i] = v->table[last];
+    v->envelope[i] = v->envelope[last];
+    v->amplitude[i] = v->amplitude[last];
+  }
+}
+
+static void voices_destroy(struct voices* v){
+  free(v->time);
+  free(v->duration);
+  free(v->gate);
+  free(v->phase);
+  free(v->increment);
+  free(v->waveform);
+  free(v->table);
+  free(v->envelope);
+  free(v->amplitude);
+  *v = (struct voices){0};
+}
+
+// Renders the next n samples of voice i, adding them to mix
+static void voice_render(const struct render_config* config, struct voices* v, size_t i, size_t n, int64_t mix[restrict n]){
+  assert(n <= RENDER_BLOCK_SIZE);
+  const uint64_t time = v->time[i];
+  v->time[i] += n;
+  if(time >= v->duration[i])
+    return;
+  const size_t count = v->duration[i] - time < n ? v->duration[i] - time : n;
+  int16_t wave[RENDER_BLOCK_SIZE];
+  if(v->table[i]){
+    wavetable_render(config->wavetable, v->table[i], count, wave, v->phase[i], v->increment[i]);
+  }else{
+    config->oscillator->kernel[v->waveform[i]](count, wave, v->phase[i], v->increment[i]);
+  }
+  v->phase[i] += v->increment[i] * count;
+  int32_t gain[RENDER_BLOCK_SIZE];
+  envelope_render(&v->envelope[i], v->gate[i], time, count, gain);
+  // A single division, so voices at full amplitude come out exactly as without it
+  const int64_t amplitude = v->amplitude[i];
+  for(size_t j=0; j<count; j++)
+    mix[j] += (int64_t)wave[j] * gain[j] * amplitude / ((int64_t)ENVELOPE_MAX * VOICE_AMPLITUDE_MAX);
+}
+
+/*
+ * Mixes the voices of a renderer using several threads.
+ * The voices are split into chunks, and each thread gets an equal range of them. A thread which runs out of chunks
+ * steals the upper half of the remaining range of another thread. Every thread mixes its voices into its own buffer,
+ * those are then summed up in the order of the threads. The mix is integer, so the result doesn't depend on which
+ * thread mixed which voice.
+ */
+struct mixer_thread {
+  pthread_t thread;
+  _Atomic uint64_t range; // Remaining chunks, first << 32 | end
+  int64_t* partial;
+};
+
+struct mixer {
+  unsigned count; // Threads, including the one calling mixer_render
+  struct mixer_thread* thread;
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  uint64_t generation;
+  unsigned pending;
+  bool quit;
+  // The current job
+  const struct render_config* config;
+  struct voices* voices;
+  size_t n;
+};
+
+struct mixer_worker_arg {
+  struct mixer* mixer;
+  unsigned index;
+};
+
+static inline uint64_t mixer_range(uint32_t first, uint32_t end){
+  return (uint64_t)first << 32 | end;
+}
+
+// Takes the first chunk of the own range
+static bool mixer_pop(struct mixer_thread* t, uint32_t* chunk){
+  uint64_t range = atomic_load(&t->range);
+  while(true){
+    const uint32_t first = range >> 32, end = range;
+    if(first >= end)
+      return false;
+    if(atomic_compare_exchange_weak(&t->range, &range, mixer_range(first+1, end))){
+      *chunk = first;
+      return true;
+    }
+  }
+}
+
+// Takes the upper half of the remaining range of another thread
+static bool mixer_steal(struct mixer* m, unsigned index){
+  for(unsigned i=1; i<m->count; i++){
+    struct mixer_thread*const victim = &m->thread[(index + i) % m->count];
+    uint64_t range = atomic_load(&victim->range);
+    while(true){
+      const uint32_t first = range >> 32, end = range;
+      if(first >= end)
+        break;
+      const uint32_t middle = first + (end - first) / 2;
+      if(atomic_compare_exchange_weak(&victim->range, &range, mixer_range(first, middle))){
+        // Nobody steals from an empty range, so this can't race
+        atomic_store(&m->thread[index].range, mixer_range(middle, end));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void mixer_work(struct mixer* m, unsigned index){
+  struct mixer_thread*const t = &m->thread[index];
+  memset(t->partial, 0, sizeof(*t->partial) * m->n);
+  do {
+    for(uint32_t chunk; mixer_pop(t, &chunk); ){
+      const size_t end = (chunk + 1) * RENDER_MIX_CHUNK < m->voices->count ? (chunk + 1) * RENDER_MIX_CHUNK : m->voices->count;
+      for(size_t i=chunk*RENDER_MIX_CHUNK; i<end; i++)
+        for(size_t j=0; j<m->n; j+=RENDER_BLOCK_SIZE)
+          voice_render(m->config, m->voices, i, m->n - j < RENDER_BLOCK_SIZE ? m->n - j : RENDER_BLOCK_SIZE, t->partial + j);
+    }
+  } while(mixer_steal(m, index));
+}
+
+static void* mixer_worker(void* arg){
+  struct mixer_worker_arg a = *(struct mixer_worker_arg*)arg;
+  free(arg);
+  struct mixer*const m = a.mixer;
+  uint64_t generation = 0;
+  pthread_mutex_lock(&m->lock);
+  while(true){
+    while(!m->quit && m->generation == generation)
+      pthread_cond_wait(&m->start, &m->lock);
+    if(m->quit)
+      break;
+    generation = m->generation;
+    pthread_mutex_unlock(&m->lock);
+    mixer_work(m, a.index);
+    pthread_mutex_lock(&m->lock);
+    if(!--m->pending)
+      pthread_cond_signal(&m->done);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return 0;
+}
+
+static void mixer_destroy(struct mixer* m){
+  if(!m)
+    return;
+  pthread_mutex_lock(&m->lock);
+  m->quit = true;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+  for(unsigned i=1; i<m->count; i++)
+    pthread_join(m->thread[i].thread, 0);
+  for(unsigned i=0; i<m->count; i++)
+    free(m->thread[i].partial);
+  free(m->thread);
+  free(m);
+}
+
+static struct mixer* mixer_create(unsigned count){
+  struct mixer* m = calloc(1, sizeof(*m));
+  if(!m){
+    fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return 0;
+  }
+  pthread_mutex_init(&m->lock, 0);
+  pthread_cond_init(&m->start, 0);
+  pthread_cond_init(&m->done, 0);
+  m->thread = calloc(count, sizeof(*m->thread));
+  if(!m->thread){
+    fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    goto error;
+  }
+  for(; m->count<count; m->count++){
+    struct mixer_thread*const t = &m->thread[m->count];
+    t->partial = malloc(sizeof(*t->partial) * RENDER_SEGMENT_SIZE);
+    if(!t->partial){
+      fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      goto error;
+    }
+    if(!m->count)
+      continue; // The first one is the thread calling mixer_render
+    struct mixer_worker_arg* arg = malloc(sizeof(*arg));
+    if(!arg){
+      fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      free(t->partial);
+      goto error;
+    }
+    *arg = (struct mixer_worker_arg){ .mixer = m, .index = m->count };
+    int err = pthread_create(&t->thread, 0, mixer_worker, arg);
+    if(err){
+      fprintf(stderr, "%s:%u: pthread_create failed (%d): %s\n", __FILE__, __LINE__, err, strerror(err));
+      free(arg);
+      free(t->partial);
+      goto error;
+    }
+  }
+  return m;
+error:
+  mixer_destroy(m);
+  return 0;
+}
+
+// Adds the next n samples of all voices to mix, n must not exceed RENDER_SEGMENT_SIZE
+static void mixer_render(struct mixer* m, const struct render_config* config, struct voices* voices, size_t n, int64_t mix[restrict n]){
+  assert(n <= RENDER_SEGMENT_SIZE);
+  const uint32_t chunks = (voices->count + RENDER_MIX_CHUNK - 1) / RENDER_MIX_CHUNK;
+  for(unsigned i=0; i<m->count; i++)
+    atomic_store(&m->thread[i].range, mixer_range(chunks * i / m->count, chunks * (i+1) / m->count));
+  pthread_mutex_lock(&m->lock);
+  m->config = config;
+  m->voices = voices;
+  m->n = n;
+  m->pending = m->count - 1;
+  m->generation++;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+  mixer_work(m, 0);
+  pthread_mutex_lock(&m->lock);
+  while(m->pending)
+    pthread_cond_wait(&m->done, &m->lock);
+  pthread_mutex_unlock(&m->lock);
+  for(unsigned i=0; i<m->count; i++){
+    const int64_t*restrict const partial = m->thread[i].partial;
+    for(size_t j=0; j<n; j++)
+      mix[j] += partial[j];
+  }
+}
+
+bool renderer_init(struct renderer* r, const struct render_config* config, const struct timeline* timeline){
+  *r = (struct renderer){
+    .config = config,
+    .timeline = timeline,
+  };
+  if(config->mix_threads > 1){
+    r->mixer = mixer_create(config->mix_threads);
+    if(!r->mixer)
+      return false;
+  }
+  return voices_reserve(&r->voices, config->voices);
+}
+
+void render_window(const struct render_config* config, const struct timeline* t, uint64_t* begin, uint64_t* end){
+  *end = config->end && config->end < t->length ? config->end : t->length;
+  *begin = config->begin < *end ? config->begin : *end;
+}
+
+bool renderer_seek(struct renderer* r, uint64_t time){
+  const struct timeline*const t = r->timeline;
+  r->voices.count = 0;
+  // end_max only grows, the voices before first all ended before time
+  size_t first = 0;
+  for(size_t n=t->count; n; ){
+    const size_t half = n / 2;
+    if(t->end_max[first + half] <= time){
+      first += half + 1;
+      n -= half + 1;
+    }else{
+      n = half;
+    }
+  }
+  // The voices from next on don't start before time
+  size_t next = first;
+  for(size_t n=t->count-next; n; ){
+    const size_t half = n / 2;
+    if(t->voice[next + half].start < time){
+      next += half + 1;
+      n -= half + 1;
+    }else{
+      n = half;
+    }
+  }
+  for(size_t i=first; i<next; i++){
+    const struct voice*const v = &t->voice[i];
+    if(v->start + v->duration <= time)
+      continue;
+    if(!voices_add(&r->voices, v, time - v->start))
+      return false;
+  }
+  r->next = next;
+  r->time = time;
+  return true;
+}
+
+bool renderer_render(struct renderer* r, size_t n, int64_t mix[restrict n]){
+  const struct timeline*const t = r->timeline;
+  memset(mix, 0, sizeof(*mix) * n);
+  while(n){
+    for(; r->next < t->count && t->voice[r->next].start <= r->time; r->next++){
+      const struct voice*const v = &t->voice[r->next];
+      if(v->start + v->duration <= r->time)
+        continue;
+      if(!voices_add(&r->voices, v, r->time - v->start))
+        return false;
+    }
+    // Stop the block where the next voice starts
+    const bool parallel = r->mixer && r->voices.count >= RENDER_MIX_PARALLEL_MIN;
+    const size_t max = parallel ? RENDER_SEGMENT_SIZE : RENDER_BLOCK_SIZE;
+    size_t count = n < max ? n : max;
+    if(r->next < t->count && t->voice[r->next].start - r->time < count)
+      count = t->voice[r->next].start - r->time;
+    if(parallel){
+      mixer_render(r->mixer, r->config, &r->voices, count, mix);
+    }else{
+      for(size_t i=0; i<r->voices.count; i++)
+        voice_render(r->config, &r->voices, i, count, mix);
+    }
+    voices_remove_ended(&r->voices);
+    mix += count;
+    n -= count;
+    r->time += count;
+  }
+  return true;
+}
+
+void renderer_destroy(struct renderer* r){
+  mixer_destroy(r->mixer);
+  r->mixer = 0;
+  voices_destroy(&r->voices);
+}
+
+static bool render_write(struct output* output, enum output_format format, size_t n, const int64_t mix[n]){
+  const size_t size = output_sample_size(format);
+  void*const out = output_reserve(output, size * n);
+  if(!out)
+    return false;
+  output_convert(format, n, mix, out);
+  output_commit(output, size * n);
+  return true;
+}
+
+// Starts the master stage at time, or takes over the one restored from the checkpoint
+static bool render_master_init(struct master* master, const struct render_config* config, struct checkpoint* checkpoint, uint64_t time){
+  if(checkpoint && checkpoint->has_master){
+    *master = checkpoint->master;
+    checkpoint->has_master = false;
+    return true;
+  }
+  if(!master_init(master, &config->master, config->format))
+    return false;
+  master_start(master, time);
+  return true;
+}
+
+// Where the render starts and ends, continuing from the checkpoint if there is one
+static void render_range(const struct render_config* config, const struct timeline* timeline, const struct checkpoint* checkpoint, uint64_t* start, uint64_t* end){
+  render_window(config, timeline, start, end);
+  if(checkpoint && checkpoint->time > *start)
+    *start = checkpoint->time < *end ? checkpoint->time : *end;
+}
+
+// Saves a checkpoint if the interval passed since the last one
+static bool render_checkpoint(struct checkpoint* checkpoint, uint64_t* next, uint64_t time, uint64_t written, struct output* output, const struct stats* stats, const struct master* master){
+  if(!checkpoint || time < *next)
+    return true;
+  *next = time + checkpoint->interval;
+  return !output_sync(output) && !checkpoint_save(checkpoint, time, written, stats, master);
+}
+
+static int render_sequential(const struct render_config* config, const struct timeline* timeline, struct stats* stats, struct output* output, struct checkpoint* checkpoint){
+  struct renderer renderer;
+  struct master master = {0};
+  const bool mastered = output && master_enabled(&config->master, config->format);
+  uint64_t start, end;
+  render_range(config, timeline, checkpoint, &start, &end);
+  uint64_t written = checkpoint ? checkpoint->written : 0;
+  uint64_t next_checkpoint = checkpoint ? start + checkpoint->interval : 0;
+  int ret = -1;
+  if(!renderer_init(&renderer, config, timeline))
+    goto out;
+  if(mastered && !render_master_init(&master, config, checkpoint, start))
+    goto out;
+  if(start && !renderer_seek(&renderer, start))
+    goto out;
+  int64_t mix[RENDER_BLOCK_SIZE];
+  for(uint64_t time=start; time<end; ){
+    const size_t n = end - time < RENDER_BLOCK_SIZE ? end - time : RENDER_BLOCK_SIZE;
+    if(!renderer_render(&renderer, n, mix))
+      goto out;
+    if(!stats_update(stats, n, mix))
+      goto out;
+    time += n;
+    if(!output)
+      continue;
+    const size_t count = mastered ? master_process(&master, n, mix) : n;
+    if(!render_write(output, config->format, count, mix))
+      goto out;
+    written += count;
+    if(!render_checkpoint(checkpoint, &next_checkpoint, time, written, output, stats, mastered ? &master : 0))
+      goto out;
+  }
+  for(size_t count; mastered && (count = master_flush(&master, RENDER_BLOCK_SIZE, mix)); )
+    if(!render_write(output, config->format, count, mix))
+      goto out;
+  ret = 0;
+out:
+  if(stats->voices_max < renderer.voices.high_water)
+    stats->voices_max = renderer.voices.high_water;
+  master_destroy(&master);
+  renderer_destroy(&renderer);
+  return ret;
+}
+
+struct segment {
+  uint64_t ready; // Index of the segment in this slot + 1, once it's rendered
+  int64_t mix[RENDER_SEGMENT_SIZE];
+  unsigned char* data;
+};
+
+struct parallel_render {
+  const struct render_config* config;
+  const struct timeline* timeline;
+  uint64_t begin;   // First sample to be rendered
+  uint64_t end;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint64_t segment_count;
+  uint64_t next;    // Next segment to be rendered
+  uint64_t written; // Segments written so far. Segment s uses slot s % slot_count.
+  size_t slot_count;
+  struct segment* slot;
+  bool mastered; // The master stage runs in order, so the writer converts the samples
+  bool failed;
+  size_t voices_max;
+};
+
+static void* render_worker(void* arg){
+  struct parallel_render*const p = arg;
+  struct renderer renderer;
+  bool ok = renderer_init(&renderer, p->config, p->timeline);
+  pthread_mutex_lock(&p->lock);
+  while(ok){
+    // Don't get too far ahead of the writer, there are only so many slots
+    while(!p->failed && p->next < p->segment_count && p->next >= p->written + p->slot_count)
+      pthread_cond_wait(&p->cond, &p->lock);
+    if(p->failed || p->next >= p->segment_count)
+      break;
+    const uint64_t s = p->next++;
+    pthread_mutex_unlock(&p->lock);
+    struct segment*const slot = &p->slot[s % p->slot_count];
+    const uint64_t start = p->begin + s * RENDER_SEGMENT_SIZE;
+    const size_t n = p->end - start < RENDER_SEGMENT_SIZE ? p->end - start : RENDER_SEGMENT_SIZE;
+    if(renderer.time != start)
+      ok = renderer_seek(&renderer, start);
+    if(ok)
+      ok = renderer_render(&renderer, n, slot->mix);
+    if(ok && slot->data && !p->mastered)
+      output_convert(p->config->format, n, slot->mix, slot->data);
+    pthread_mutex_lock(&p->lock);
+    slot->ready = s + 1;
+    pthread_cond_broadcast(&p->cond);
+  }
+  if(!ok)
+    p->failed = true;
+  if(p->voices_max < renderer.voices.high_water)
+    p->voices_max = renderer.voices.high_water;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  renderer_destroy(&renderer);
+  return 0;
+}
+
+static int render_parallel(const struct render_config* config, const struct timeline* timeline, struct stats* stats, struct output* output, unsigned threads, struct checkpoint* checkpoint){
+  int ret = -1;
+  const size_t size = output_sample_size(config->format);
+  uint64_t begin, end;
+  render_range(config, timeline, checkpoint, &begin, &end);
+  uint64_t written = checkpoint ? checkpoint->written : 0;
+  uint64_t next_checkpoint = checkpoint ? begin + checkpoint->interval : 0;
+  struct parallel_render p = {
+    .config = config,
+    .timeline = timeline,
+    .begin = begin,
+    .end = end,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .segment_count = (end - begin + RENDER_SEGMENT_SIZE - 1) / RENDER_SEGMENT_SIZE,
+    .slot_count = threads * 2,
+    .mastered = output && master_enabled(&config->master, config->format),
+  };
+  struct master master = {0};
+  pthread_t* thread = calloc(threads, sizeof(*thread));
+  p.slot = calloc(p.slot_count, sizeof(*p.slot));
+  if(!thread || !p.slot){
+    fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    goto out;
+  }
+  for(size_t i=0; i<p.slot_count && output; i++){
+    p.slot[i].data = malloc(size * RENDER_SEGMENT_SIZE);
+    if(!p.slot[i].data){
+      fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      goto out;
+    }
+  }
+  if(p.mastered && !render_master_init(&master, config, checkpoint, begin))
+    goto out;
+  unsigned started = 0;
+  for(; started<threads; started++){
+    int err = pthread_create(&thread[started], 0, render_worker, &p);
+    if(err){
+      fprintf(stderr, "%s:%u: pthread_create failed (%d): %s\n", __FILE__, __LINE__, err, strerror(err));
+      pthread_mutex_lock(&p.lock);
+      p.failed = true;
+      pthread_mutex_unlock(&p.lock);
+      break;
+    }
+  }
+  // Write the segments in order as they become ready. The stats are updated here too, so they're summed up in order.
+  pthread_mutex_lock(&p.lock);
+  for(uint64_t s=0; s<p.segment_count; s++){
+    struct segment*const slot = &p.slot[s % p.slot_count];
+    while(!p.failed && slot->ready != s + 1)
+      pthread_cond_wait(&p.cond, &p.lock);
+    if(p.failed)
+      break;
+    pthread_mutex_unlock(&p.lock);
+    const uint64_t start = begin + s * RENDER_SEGMENT_SIZE;
+    const size_t n = end - start < RENDER_SEGMENT_SIZE ? end - start : RENDER_SEGMENT_SIZE;
+    bool ok = stats_update(stats, n, slot->mix);
+    if(ok && output){
+      size_t count = n;
+      if(p.mastered){
+        count = master_process(&master, n, slot->mix);
+        output_convert(config->format, count, slot->mix, slot->data);
+      }
+      ok = !output_write(output, size * count, slot->data);
+      written += count;
+      ok = ok && render_checkpoint(checkpoint, &next_checkpoint, start + n, written, output, stats, p.mastered ? &master : 0);
+    }
+    pthread_mutex_lock(&p.lock);
+    if(!ok)
+      p.failed = true;
+    slot->ready = 0;
+    p.written = s + 1;
+    pthread_cond_broadcast(&p.cond);
+  }
+  pthread_mutex_unlock(&p.lock);
+  for(unsigned i=0; i<started; i++)
+    pthread_join(thread[i], 0);
+  // The workers are done, their buffers can be used for what the master stage held back
+  for(size_t count; !p.failed && p.mastered && (count = master_flush(&master, RENDER_SEGMENT_SIZE, p.slot[0].mix)); ){
+    output_convert(config->format, count, p.slot[0].mix, p.slot[0].data);
+    if(output_write(output, size * count, p.slot[0].data))
+      p.failed = true;
+  }
+  if(!p.failed && started == threads)
+    ret = 0;
+  if(stats->voices_max < p.voices_max)
+    stats->voices_max = p.voices_max;
+out:
+  if(p.slot)
+    for(size_t i=0; i<p.slot_count; i++)
+      free(p.slot[i].data);
+  free(p.slot);
+  free(thread);
+  master_destroy(&master);
+  return ret;
+}
+
+int render_timeline(const struct render_config* config, const struct timeline* timeline, struct stats* stats, struct output* output, unsigned threads, struct checkpoint* checkpoint){
+  if(!output)
+    checkpoint = 0;
+  if(threads <= 1)
+    return render_sequential(config, timeline, stats, output, checkpoint);
+  return render_parallel(config, timeline, stats, output, threads, checkpoint);
+}
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include <ringbuffer.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
@@ -7,25 +8,36 @@
 #include <unistd.h>
 #include <stdio.h>
 
+/*
+ * The read and write positions only ever increase, and wrap around at 2^32.
+ * The size is a power of 2, so the offset in the buffer is the position modulo the size.
+ * Only the reader changes the read position, and only the writer the write position.
+ */
 struct ringbuffer {
   char* buffer;
-  unsigned offset, size;
+  unsigned size;
+  _Atomic unsigned read, write;
 };
 
-__attribute__((const))
-static inline unsigned get_ringbuffer_size(void){
-  const unsigned sz = sysconf(_SC_PAGESIZE);
-  return (sz-1 + 4096) / sz * sz;
+static unsigned get_ringbuffer_size(unsigned minimum){
+  unsigned size = sysconf(_SC_PAGESIZE);
+  while(size && size < minimum)
+    size *= 2;
+  return size;
 }
 
-struct ringbuffer* ringbuffer_create(void){
+struct ringbuffer* ringbuffer_create(unsigned minimum_size){
   struct ringbuffer* rb = calloc(1,sizeof(struct ringbuffer));
   if(!rb){
     fprintf(stderr, "%s:%u: calloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
     goto error;
   }
 
-  const unsigned size = get_ringbuffer_size();
+  const unsigned size = get_ringbuffer_size(minimum_size ? minimum_size : RINGBUFFER_DEFAULT_SIZE);
+  if(!size || size > 0x40000000u){
+    fprintf(stderr, "%s:%u: ringbuffer size too large: %u\n", __FILE__, __LINE__, minimum_size);
+    goto error_calloc;
+  }
 
   const int memfd = memfd_create("ml666 json token emmiter ringbuffer", MFD_CLOEXEC);
   if(memfd == -1){
@@ -39,7 +51,7 @@ struct ringbuffer* ringbuffer_create(void){
   }
 
   // Allocate any 4 free pages |A|B|C|D|
-  char*const mem = mmap(0, size*4, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char*const mem = mmap(0, (size_t)size*4, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   if(mem == MAP_FAILED){
     fprintf(stderr, "%s:%u: mmap failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
     goto error_memfd;
@@ -72,11 +84,12 @@ struct ringbuffer* ringbuffer_create(void){
   close(memfd);
 
   rb->buffer = mem;
+  rb->size = size;
 
   return rb;
 
 error_mmap:
-  munmap(mem, size*4);
+  munmap(mem, (size_t)size*4);
 error_memfd:
   close(memfd);
 error_calloc:
@@ -86,52 +99,48 @@ error:
 }
 
 struct buffer_ro ringbuffer_get_read_buffer(const struct ringbuffer* rb){
-  const unsigned size = get_ringbuffer_size();
+  const unsigned read = atomic_load_explicit(&rb->read, memory_order_relaxed);
+  const unsigned write = atomic_load_explicit(&rb->write, memory_order_acquire);
   return (struct buffer_ro){
-    .length = rb->size,
-    .v = &rb->buffer[size+rb->offset],
+    .length = write - read,
+    .v = &rb->buffer[rb->size + (read & (rb->size - 1))],
   };
 }
 
 void ringbuffer_discard(struct ringbuffer* rb, int count){
-  const unsigned size = get_ringbuffer_size();
-  unsigned offset = rb->offset;
+  const unsigned read = atomic_load_explicit(&rb->read, memory_order_relaxed);
+  const unsigned length = atomic_load_explicit(&rb->write, memory_order_acquire) - read;
   if(count < 0)
     count = 0;
-  if((unsigned)count > rb->size)
-    count = rb->size;
-  rb->size -= count;
-  offset += count;
-  if(offset >= size)
-    offset -= size;
-  rb->offset = offset;
+  if((unsigned)count > length)
+    count = length;
+  atomic_store_explicit(&rb->read, read + count, memory_order_release);
 }
 
 struct buffer_wo ringbuffer_get_write_buffer(const struct ringbuffer* rb){
-  const unsigned size = get_ringbuffer_size();
-  unsigned offset = rb->size + rb->offset;
-  if(offset >= size)
-    offset -= size;
+  const unsigned write = atomic_load_explicit(&rb->write, memory_order_relaxed);
+  const unsigned read = atomic_load_explicit(&rb->read, memory_order_acquire);
   return (struct buffer_wo){
-    .length = size - rb->size,
-    .v = &rb->buffer[offset],
+    .length = rb->size - (write - read),
+    .v = &rb->buffer[write & (rb->size - 1)],
   };
 }
 
 void ringbuffer_commit(struct ringbuffer* rb, int count){
-  const int size = get_ringbuffer_size();
+  const unsigned write = atomic_load_explicit(&rb->write, memory_order_relaxed);
+  const unsigned space = rb->size - (write - atomic_load_explicit(&rb->read, memory_order_acquire));
   if(count < 0)
     return;
-  if(count > size)
-    count = size;
-  count += rb->size;
-  if(count > size)
-    count = size;
-  rb->size = count;
+  if((unsigned)count > space)
+    count = space;
+  atomic_store_explicit(&rb->write, write + count, memory_order_release);
+}
+
+unsigned ringbuffer_size(const struct ringbuffer* rb){
+  return rb->size;
 }
 
 void ringbuffer_destroy(struct ringbuffer* rb){
-  const unsigned size = get_ringbuffer_size();
-  munmap(rb->buffer, size*4);
+  munmap(rb->buffer, (size_t)rb->size*4);
   free(rb);
 }
@@ -0,0 +1,263 @@
+#include <smf.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+// Events decoded per call of the parser
+#define SMF_DECODE_BATCH 256
+
+static uint32_t get_u32(const uint8_t* p){
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t get_u16(const uint8_t* p){
+  return p[0] << 8 | p[1];
+}
+
+int smf_parse(struct smf* smf, size_t size, const uint8_t data[size]){
+  *smf = (struct smf){0};
+  if(!smf_is(size, data) || size < 14 || get_u32(data+4) < 6){
+    fprintf(stderr, "not a standard MIDI file\n");
+    return -1;
+  }
+  const size_t header_size = 8 + (size_t)get_u32(data+4);
+  const uint16_t announced = get_u16(data+10);
+  smf->format = get_u16(data+8);
+  smf->division = get_u16(data+12);
+  if(!smf->division || header_size > size){
+    fprintf(stderr, "invalid MIDI file header\n");
+    return -1;
+  }
+  size_t capacity = 0;
+  for(size_t offset=header_size; size - offset >= 8; ){
+    const uint8_t*const chunk = data + offset;
+    size_t length = get_u32(chunk+4);
+    if(length > size - offset - 8){
+      fprintf(stderr, "chunk at %zu is truncated\n", offset);
+      length = size - offset - 8;
+    }
+    offset += 8 + length;
+    if(memcmp(chunk, SMF_TRACK_MAGIC, 4))
+      continue;
+    if(smf->track_count >= capacity){
+      capacity = capacity ? capacity * 2 : 16;
+      struct smf_track* track = realloc(smf->track, sizeof(*track) * capacity);
+      if(!track){
+        fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+        smf_destroy(smf);
+        return -1;
+      }
+      smf->track = track;
+    }
+    smf->track[smf->track_count++] = (struct smf_track){
+      .size = length,
+      .data = chunk + 8,
+    };
+  }
+  if(smf->track_count != announced)
+    fprintf(stderr, "the MIDI file has %zu tracks instead of %u\n", smf->track_count, announced);
+  return 0;
+}
+
+static bool smf_track_reserve(struct smf_track* t, size_t count){
+  if(t->count + count <= t->capacity)
+    return true;
+  // Events take at least a few bytes, so the first guess is usually enough
+  size_t capacity = t->capacity ? t->capacity * 2 : t->size / 4 + SMF_DECODE_BATCH;
+  if(capacity < t->count + count)
+    capacity = t->count + count;
+  struct midi_event* e = realloc(t->event, sizeof(*e) * capacity);
+  if(!e){
+    fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  t->event = e;
+  t->capacity = capacity;
+  return true;
+}
+
+static int smf_decode_track(struct smf_track* t, size_t index){
+  struct midi_event_parser parser = {
+    .has_timing = true,
+  };
+  for(size_t offset=0; offset<t->size; ){
+    if(!smf_track_reserve(t, SMF_DECODE_BATCH))
+      return -1;
+    size_t count = 0;
+    const ssize_t res = midi_event_parser_parse_batch(&parser, t->size - offset, t->data + offset, true, SMF_DECODE_BATCH, t->event + t->count, &count);
+    if(res < 0){
+      fprintf(stderr, "invalid data in track %zu at %zu\n", index, offset);
+      return -1;
+    }
+    for(size_t i=0; i<count; i++){
+      // Anything after the end of the track is padding
+      if(t->event[t->count++].type == MIDI_MESSAGE_META_END_OF_TRACK)
+        return 0;
+    }
+    if(!res){
+      fprintf(stderr, "track %zu is truncated\n", index);
+      return 0;
+    }
+    offset += res;
+  }
+  return 0;
+}
+
+struct smf_decoder {
+  struct smf* smf;
+  atomic_size_t next;
+  atomic_bool failed;
+};
+
+static void* smf_decode_worker(void* arg){
+  struct smf_decoder*const d = arg;
+  for(size_t i; !atomic_load(&d->failed) && (i = atomic_fetch_add(&d->next, 1)) < d->smf->track_count; )
+    if(smf_decode_track(&d->smf->track[i], i))
+      atomic_store(&d->failed, true);
+  return 0;
+}
+
+int smf_decode(struct smf* smf, unsigned threads){
+  struct smf_decoder d = {
+    .smf = smf,
+  };
+  atomic_init(&d.next, 0);
+  atomic_init(&d.failed, false);
+  if(threads > smf->track_count)
+    threads = smf->track_count;
+  pthread_t thread[threads ? threads : 1];
+  // The calling thread is one of the workers
+  unsigned started = 0;
+  for(; started+1<threads; started++){
+    int err = pthread_create(&thread[started], 0, smf_decode_worker, &d);
+    if(err){
+      fprintf(stderr, "%s:%u: pthread_create failed (%d): %s\n", __FILE__, __LINE__, err, strerror(err));
+      break;
+    }
+  }
+  smf_decode_worker(&d);
+  for(unsigned i=0; i<started; i++)
+    pthread_join(thread[i], 0);
+  return atomic_load(&d.failed) ? -1 : 0;
+}
+
+struct smf_tempo {
+  uint64_t tick;
+  size_t track;
+  size_t index;
+  uint32_t tempo;
+};
+
+static int smf_tempo_compare(const void* a, const void* b){
+  const struct smf_tempo*const x = a;
+  const struct smf_tempo*const y = b;
+  if(x->tick != y->tick)
+    return x->tick < y->tick ? -1 : 1;
+  if(x->track != y->track)
+    return x->track < y->track ? -1 : 1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+bool smf_tempo_map(const struct smf* smf, struct tempo_map* map){
+  if(!tempo_map_init(map, smf->division))
+    return false;
+  size_t count = 0, capacity = 0;
+  struct smf_tempo* tempo = 0;
+  for(size_t t=0; t<smf->track_count; t++){
+    const struct smf_track*const track = &smf->track[t];
+    for(size_t i=0; i<track->count; i++){
+      const struct midi_event*const e = &track->event[i];
+      if(e->type != MIDI_MESSAGE_META_SET_TEMPO || e->len != 3)
+        continue;
+      if(count >= capacity){
+        capacity = capacity ? capacity * 2 : 64;
+        struct smf_tempo* n = realloc(tempo, sizeof(*n) * capacity);
+        if(!n){
+          fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+          free(tempo);
+          tempo_map_destroy(map);
+          return false;
+        }
+        tempo = n;
+      }
+      const uint8_t*const d = e->data;
+      tempo[count++] = (struct smf_tempo){e->time, t, i, (uint32_t)d[0] << 16 | d[1] << 8 | d[2]};
+    }
+  }
+  // In the order the merged events have
+  qsort(tempo, count, sizeof(*tempo), smf_tempo_compare);
+  bool ok = true;
+  for(size_t i=0; ok && i<count; i++)
+    ok = tempo_map_add(map, tempo[i].tick, tempo[i].tempo);
+  free(tempo);
+  if(!ok)
+    tempo_map_destroy(map);
+  return ok;
+}
+
+void smf_destroy(struct smf* smf){
+  for(size_t i=0; i<smf->track_count; i++)
+    free(smf->track[i].event);
+  free(smf->track);
+  *smf = (struct smf){0};
+}
+
+static bool smf_merge_less(const struct smf_merge_entry* a, const struct smf_merge_entry* b){
+  return a->time < b->time || (a->time == b->time && a->track < b->track);
+}
+
+static void smf_merge_sift_down(struct smf_merge* m, size_t i){
+  const struct smf_merge_entry entry = m->heap[i];
+  while(2*i+1 < m->count){
+    size_t child = 2*i+1;
+    if(child+1 < m->count && smf_merge_less(&m->heap[child+1], &m->heap[child]))
+      child++;
+    if(!smf_merge_less(&m->heap[child], &entry))
+      break;
+    m->heap[i] = m->heap[child];
+    i = child;
+  }
+  m->heap[i] = entry;
+}
+
+bool smf_merge_init(struct smf_merge* m, const struct smf* smf){
+  *m = (struct smf_merge){
+    .smf = smf,
+  };
+  if(!smf->track_count)
+    return true;
+  m->heap = malloc(sizeof(*m->heap) * smf->track_count);
+  if(!m->heap){
+    fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  for(size_t i=0; i<smf->track_count; i++)
+    if(smf->track[i].count)
+      m->heap[m->count++] = (struct smf_merge_entry){smf->track[i].event[0].time, i, 0};
+  for(size_t i=m->count/2; i--; )
+    smf_merge_sift_down(m, i);
+  return true;
+}
+
+const struct midi_event* smf_merge_next(struct smf_merge* m){
+  if(!m->count)
+    return 0;
+  struct smf_merge_entry*const top = &m->heap[0];
+  const struct smf_track*const track = &m->smf->track[top->track];
+  const struct midi_event*const event = &track->event[top->index++];
+  if(top->index < track->count){
+    top->time = track->event[top->index].time;
+  }else{
+    *top = m->heap[--m->count];
+  }
+  if(m->count)
+    smf_merge_sift_down(m, 0);
+  return event;
+}
+
+void smf_merge_destroy(struct smf_merge* m){
+  free(m->heap);
+  *m = (struct smf_merge){0};
+}
@@ -0,0 +1,152 @@
+#include <stats.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The interpolated positions lie between the samples CENTER and CENTER+1 of the taps
+#define CENTER (STATS_TRUE_PEAK_TAPS / 2 - 1)
+
+void stats_init(struct stats* s, uint64_t window_size){
+  *s = (struct stats){
+    .min = INT64_MAX,
+    .max = INT64_MIN,
+    .window_size = window_size,
+  };
+  // Blackman windowed sinc, the window spans all the taps
+  const double half_width = STATS_TRUE_PEAK_TAPS / 2.0;
+  for(unsigned p=0; p<STATS_TRUE_PEAK_OVERSAMPLING-1; p++){
+    const double fraction = (p + 1.0) / STATS_TRUE_PEAK_OVERSAMPLING;
+    double sum = 0;
+    for(unsigned i=0; i<STATS_TRUE_PEAK_TAPS; i++){
+      const double d = (double)i - CENTER - fraction;
+      const double window = 0.42 + 0.5 * cos(M_PI * d / half_width) + 0.08 * cos(2 * M_PI * d / half_width);
+      const double c = sin(M_PI * d) / (M_PI * d) * window;
+      s->coefficient[p][i] = c;
+      sum += fabs(c);
+    }
+    if(s->coefficient_bound < sum)
+      s->coefficient_bound = sum;
+  }
+}
+
+static bool stats_window_push(struct stats* s, uint64_t peak){
+  if(s->window_count >= s->window_capacity){
+    const size_t capacity = s->window_capacity ? s->window_capacity * 2 : 1024;
+    uint64_t* w = realloc(s->window_peak, sizeof(*w) * capacity);
+    if(!w){
+      fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return false;
+    }
+    s->window_peak = w;
+    s->window_capacity = capacity;
+  }
+  s->window_peak[s->window_count++] = peak;
+  return true;
+}
+
+static bool stats_windows(struct stats* s, size_t n, const int64_t mix[n]){
+  for(size_t i=0; i<n; ){
+    if(!s->window_fill){
+      if(!stats_window_push(s, 0))
+        return false;
+    }
+    size_t count = s->window_size - s->window_fill;
+    if(count > n - i)
+      count = n - i;
+    uint64_t peak = s->window_peak[s->window_count-1];
+    for(size_t j=i; j<i+count; j++){
+      const uint64_t a = mix[j] < 0 ? -(uint64_t)mix[j] : (uint64_t)mix[j];
+      if(peak < a)
+        peak = a;
+    }
+    s->window_peak[s->window_count-1] = peak;
+    s->window_fill += count;
+    if(s->window_fill == s->window_size)
+      s->window_fill = 0;
+    i += count;
+  }
+  return true;
+}
+
+static void stats_true_peak(struct stats* s, size_t n, const int64_t mix[n]){
+  double buffer[STATS_TRUE_PEAK_TAPS-1 + STATS_TRUE_PEAK_CHUNK];
+  const size_t h = STATS_TRUE_PEAK_TAPS-1;
+  for(size_t i=0; i<n; ){
+    size_t count = n - i < STATS_TRUE_PEAK_CHUNK ? n - i : STATS_TRUE_PEAK_CHUNK;
+    memcpy(buffer, s->history, sizeof(s->history));
+    double peak = 0;
+    for(size_t j=0; j<h; j++)
+      peak = fmax(peak, fabs(buffer[j]));
+    for(size_t j=0; j<count; j++){
+      buffer[h+j] = mix[i+j];
+      peak = fmax(peak, fabs(buffer[h+j]));
+    }
+    // Skip what can't exceed the peak found so far, which is most of the signal once the loudest part was seen
+    if(peak * s->coefficient_bound > s->true_peak){
+      for(size_t c=CENTER; c+STATS_TRUE_PEAK_TAPS-CENTER<=h+count; c++){
+        const double*const x = &buffer[c-CENTER];
+        for(unsigned p=0; p<STATS_TRUE_PEAK_OVERSAMPLING-1; p++){
+          double y = 0;
+          for(unsigned k=0; k<STATS_TRUE_PEAK_TAPS; k++)
+            y += x[k] * s->coefficient[p][k];
+          s->true_peak = fmax(s->true_peak, fabs(y));
+        }
+      }
+    }
+    memcpy(s->history, buffer + count, sizeof(s->history));
+    i += count;
+  }
+}
+
+bool stats_update(struct stats* s, size_t n, const int64_t mix[n]){
+  int64_t min = s->min, max = s->max;
+  uint64_t abs_sum = 0; // Can't overflow with fewer than 2^24 samples below 2^40
+  stats_uint128_t square_sum = 0;
+  for(size_t i=0; i<n; ){
+    const size_t count = n - i < 0x1000000 ? n - i : 0x1000000;
+    for(size_t j=i; j<i+count; j++){
+      const int64_t amplitude = mix[j];
+      const uint64_t a = amplitude < 0 ? -(uint64_t)amplitude : (uint64_t)amplitude;
+      min = amplitude < min ? amplitude : min;
+      max = amplitude > max ? amplitude : max;
+      abs_sum += a;
+      square_sum += (stats_uint128_t)a * a;
+    }
+    s->abs_sum += abs_sum;
+    abs_sum = 0;
+    i += count;
+  }
+  s->min = min;
+  s->max = max;
+  s->square_sum += square_sum;
+  const uint64_t peak = max > 0 ? (uint64_t)max : 0;
+  const uint64_t negative_peak = min < 0 ? -(uint64_t)min : 0;
+  s->peak = peak > negative_peak ? peak : negative_peak;
+  s->samples_total += n;
+  stats_true_peak(s, n, mix);
+  if(s->window_size && !stats_windows(s, n, mix))
+    return false;
+  return true;
+}
+
+bool stats_finish(struct stats* s){
+  // The samples after the end are silence
+  static const int64_t silence[STATS_TRUE_PEAK_TAPS] = {0};
+  stats_true_peak(s, STATS_TRUE_PEAK_TAPS, silence);
+  // The samples themselves are positions of the oversampled signal too
+  if(s->true_peak < s->peak)
+    s->true_peak = s->peak;
+  return true;
+}
+
+void stats_destroy(struct stats* s){
+  free(s->window_peak);
+  s->window_peak = 0;
+  s->window_count = s->window_capacity = 0;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <stream.h>
+#include <ringbuffer.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+struct stream {
+  const struct render_config* config;
+  const struct timeline* timeline;
+  struct stats* stats;
+  struct ringbuffer* rb;
+  uint64_t block_ns; // Playback time of one block
+  _Atomic bool done;   // Set by the renderer once everything is in the ring buffer, or it failed
+  _Atomic bool failed;
+  _Atomic bool stop;   // Set by the writer if the renderer should give up
+};
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns){
+  struct timespec ts = {
+    .tv_sec  = ns / 1000000000,
+    .tv_nsec = ns % 1000000000,
+  };
+  while(nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+// Waits until len bytes can be written to the ring buffer, fails if the writer gave up
+static bool stream_wait(struct stream* s, size_t len, struct buffer_wo* wo){
+  while((*wo = ringbuffer_get_write_buffer(s->rb)).length < len){
+    if(atomic_load(&s->stop))
+      return false;
+    sleep_ns(s->block_ns / 2);
+  }
+  return true;
+}
+
+static void* stream_render(void* arg){
+  struct stream*const s = arg;
+  const struct render_config*const config = s->config;
+  const size_t size = output_sample_size(config->format);
+  struct renderer renderer;
+  struct master master = {0};
+  const bool mastered = master_enabled(&config->master, config->format);
+  bool ok = false;
+  if(!renderer_init(&renderer, config, s->timeline))
+    goto out;
+  uint64_t begin, end;
+  render_window(config, s->timeline, &begin, &end);
+  if(mastered){
+    if(!master_init(&master, &config->master, config->format))
+      goto out;
+    master_start(&master, begin);
+  }
+  if(begin && !renderer_seek(&renderer, begin))
+    goto out;
+  int64_t mix[RENDER_BLOCK_SIZE];
+  struct buffer_wo wo;
+  for(uint64_t time=begin; time<end; ){
+    const size_t n = end - time < RENDER_BLOCK_SIZE ? end - time : RENDER_BLOCK_SIZE;
+    // Wait for the writer to make room, there is nothing to do until then
+    if(!stream_wait(s, size * n, &wo))
+      goto out;
+    if(!renderer_render(&renderer, n, mix))
+      goto out;
+    if(!stats_update(s->stats, n, mix))
+      goto out;
+    const size_t count = mastered ? master_process(&master, n, mix) : n;
+    output_convert(config->format, count, mix, wo.v);
+    ringbuffer_commit(s->rb, size * count);
+    time += n;
+  }
+  while(mastered){
+    if(!stream_wait(s, size * RENDER_BLOCK_SIZE, &wo))
+      goto out;
+    const size_t count = master_flush(&master, RENDER_BLOCK_SIZE, mix);
+    if(!count)
+      break;
+    output_convert(config->format, count, mix, wo.v);
+    ringbuffer_commit(s->rb, size * count);
+  }
+  ok = true;
+out:
+  if(s->stats->voices_max < renderer.voices.high_water)
+    s->stats->voices_max = renderer.voices.high_water;
+  master_destroy(&master);
+  renderer_destroy(&renderer);
+  atomic_store(&s->failed, !ok);
+  atomic_store(&s->done, true);
+  return 0;
+}
+
+int render_stream(const struct render_config* config, const struct timeline* timeline, struct stats* stats, int fd, unsigned latency_ms, struct stream_report* report){
+  const uint32_t sps = config->samples_per_second;
+  const size_t size = output_sample_size(config->format);
+  uint64_t latency = (uint64_t)sps * latency_ms / 1000;
+  if(latency < RENDER_BLOCK_SIZE)
+    latency = RENDER_BLOCK_SIZE;
+  *report = (struct stream_report){0};
+  struct stream s = {
+    .config = config,
+    .timeline = timeline,
+    .stats = stats,
+    .block_ns = (uint64_t)RENDER_BLOCK_SIZE * 1000000000 / sps,
+  };
+  // Room for the latency, and for a block being rendered while the writer waits for the latency to pass
+  s.rb = ringbuffer_create((latency + RENDER_BLOCK_SIZE) * size);
+  if(!s.rb)
+    return -1;
+  pthread_t thread;
+  int err = pthread_create(&thread, 0, stream_render, &s);
+  if(err){
+    fprintf(stderr, "%s:%u: pthread_create failed (%d): %s\n", __FILE__, __LINE__, err, strerror(err));
+    ringbuffer_destroy(s.rb);
+    return -1;
+  }
+  int ret = -1;
+  // Fill up the latency before starting the playback
+  while(!atomic_load(&s.done) && ringbuffer_get_read_buffer(s.rb).length < latency * size)
+    sleep_ns(s.block_ns / 2);
+  uint64_t start = now_ns();
+  uint64_t played_before = 0; // Samples played before start
+  uint64_t written = 0; // in bytes
+  bool underrun = false;
+  while(true){
+    const bool done = atomic_load(&s.done);
+    const struct buffer_ro ro = ringbuffer_get_read_buffer(s.rb);
+    const uint64_t played = played_before + (now_ns() - start) * sps / 1000000000;
+    if(!ro.length){
+      if(done)
+        break;
+      // The playback caught up with the renderer
+      if(!underrun && played >= written / size){
+        underrun = true;
+        report->underruns++;
+        fprintf(stderr, "underrun at %.3fs\n", (double)(written / size) / sps);
+      }
+      sleep_ns(s.block_ns / 4);
+      continue;
+    }
+    if(underrun){
+      // Like at the start, fill up the latency again, then the playback continues where it stopped
+      if(!done && ro.length < latency * size){
+        sleep_ns(s.block_ns / 2);
+        continue;
+      }
+      underrun = false;
+      report->underrun_samples += played - written / size;
+      start = now_ns();
+      played_before = written / size;
+      continue;
+    }
+    if(written / size >= played + latency){
+      sleep_ns((written / size - played - latency + RENDER_BLOCK_SIZE) * 1000000000 / sps);
+      continue;
+    }
+    size_t length = (played + latency) * size - written;
+    if(length > ro.length)
+      length = ro.length;
+    ssize_t result = write(fd, ro.v, length);
+    if(result == -1){
+      if(errno == EINTR)
+        continue;
+      fprintf(stderr, "%s:%u: write failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      atomic_store(&s.stop, true);
+      goto out;
+    }
+    ringbuffer_discard(s.rb, result);
+    written += result;
+  }
+  ret = atomic_load(&s.failed) ? -1 : 0;
+out:
+  pthread_join(thread, 0);
+  ringbuffer_destroy(s.rb);
+  return ret;
+}
@@ -0,0 +1,115 @@
+#include <tempo_map.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+__extension__ typedef unsigned __int128 tempo_map_uint128_t;
+
+bool tempo_map_init(struct tempo_map* map, uint16_t division){
+  *map = (struct tempo_map){
+    .division = division,
+  };
+  uint64_t units_per_tick;
+  if(division & 0x8000){
+    // SMPTE, negated frames per second and ticks per frame. 29 frames is drop frame, 29.97 per second
+    const int frames = -(int8_t)(division >> 8);
+    const unsigned ticks = division & 0xFF;
+    if(frames <= 0 || !ticks){
+      fprintf(stderr, "invalid MIDI time division 0x%04X\n", division);
+      return false;
+    }
+    map->units_per_second = (frames == 29 ? 2997 : frames * 100) * (uint64_t)ticks;
+    units_per_tick = 100;
+  }else{
+    if(!division){
+      fprintf(stderr, "invalid MIDI time division 0\n");
+      return false;
+    }
+    map->units_per_second = division * (uint64_t)1000000;
+    units_per_tick = TEMPO_MAP_DEFAULT_TEMPO;
+  }
+  map->segment = malloc(sizeof(*map->segment) * 16);
+  if(!map->segment){
+    fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return false;
+  }
+  map->capacity = 16;
+  map->segment[map->count++] = (struct tempo_segment){
+    .units_per_tick = units_per_tick,
+  };
+  return true;
+}
+
+bool tempo_map_add(struct tempo_map* map, uint64_t tick, uint32_t tempo){
+  if(map->division & 0x8000)
+    return true;
+  struct tempo_segment*const last = &map->segment[map->count-1];
+  if(tick < last->tick)
+    return false;
+  if(last->units_per_tick == tempo)
+    return true;
+  // A later change at the same tick replaces the earlier one
+  if(tick == last->tick){
+    last->units_per_tick = tempo;
+    return true;
+  }
+  if(map->count >= map->capacity){
+    const size_t capacity = map->capacity * 2;
+    struct tempo_segment* s = realloc(map->segment, sizeof(*s) * capacity);
+    if(!s){
+      fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      return false;
+    }
+    map->segment = s;
+    map->capacity = capacity;
+  }
+  const struct tempo_segment*const previous = &map->segment[map->count-1];
+  map->segment[map->count] = (struct tempo_segment){
+    .tick = tick,
+    .time = previous->time + (tick - previous->tick) * previous->units_per_tick,
+    .units_per_tick = tempo,
+  };
+  map->count++;
+  return true;
+}
+
+static uint64_t tempo_segment_time(const struct tempo_segment* s, uint64_t tick){
+  return s->time + (tick - s->tick) * s->units_per_tick;
+}
+
+// The last segment starting at or before tick, the first one starts at 0
+static size_t tempo_map_find(const struct tempo_map* map, uint64_t tick){
+  size_t first = 1;
+  for(size_t n=map->count-1; n; ){
+    const size_t half = n / 2;
+    if(map->segment[first + half].tick <= tick){
+      first += half + 1;
+      n -= half + 1;
+    }else{
+      n = half;
+    }
+  }
+  return first - 1;
+}
+
+uint64_t tempo_map_time(const struct tempo_map* map, uint64_t tick){
+  return tempo_segment_time(&map->segment[tempo_map_find(map, tick)], tick);
+}
+
+uint64_t tempo_map_next(struct tempo_map* map, uint64_t tick){
+  if(map->segment[map->cursor].tick > tick)
+    map->cursor = tempo_map_find(map, tick);
+  while(map->cursor+1 < map->count && map->segment[map->cursor+1].tick <= tick)
+    map->cursor++;
+  return tempo_segment_time(&map->segment[map->cursor], tick);
+}
+
+uint64_t tempo_map_scale(const struct tempo_map* map, uint64_t time, uint64_t rate){
+  return ((tempo_map_uint128_t)time * rate + map->units_per_second / 2) / map->units_per_second;
+}
+
+void tempo_map_destroy(struct tempo_map* map){
+  free(map->segment);
+  *map = (struct tempo_map){0};
+}
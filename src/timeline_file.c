@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <timeline_file.h>
+#include <output.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(struct timeline_file_header) == 56, "unexpected padding in timeline_file_header");
+_Static_assert(sizeof(struct timeline_file_voice) == 56, "unexpected padding in timeline_file_voice");
+
+uint64_t timeline_source_hash(size_t size, const void* data){
+  const unsigned char* p = data;
+  uint64_t hash = 0xCBF29CE484222325;
+  for(size_t i=0; i<size; i++){
+    hash ^= p[i];
+    hash *= 0x100000001B3;
+  }
+  return hash;
+}
+
+int timeline_save(const char* path, const struct timeline* t, uint32_t samples_per_second, uint64_t source_hash){
+  char tmp[4096];
+  if((size_t)snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid()) >= sizeof(tmp)){
+    fprintf(stderr, "%s:%u: path too long: %s\n", __FILE__, __LINE__, path);
+    return -1;
+  }
+  const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(fd == -1){
+    fprintf(stderr, "%s:%u: open failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  struct timeline_file_header header = {
+    .magic = TIMELINE_FILE_MAGIC,
+    .version = TIMELINE_FILE_VERSION,
+    .byte_order = TIMELINE_FILE_BYTE_ORDER,
+    .samples_per_second = samples_per_second,
+    .source_hash = source_hash,
+    .count = t->count,
+    .length = t->length,
+    .end = t->end,
+  };
+  if(write_all(fd, sizeof(header), &header))
+    goto error;
+  struct timeline_file_voice block[256];
+  for(size_t i=0; i<t->count; ){
+    size_t n = 0;
+    for(; n<sizeof(block)/sizeof(*block) && i<t->count; n++, i++){
+      const struct voice*const v = &t->voice[i];
+      block[n] = (struct timeline_file_voice){
+        .start = v->start,
+        .duration = v->duration,
+        .gate = v->gate,
+        .phase = v->phase,
+        .increment = v->increment,
+        .attack = v->envelope.attack,
+        .decay = v->envelope.decay,
+        .release = v->envelope.release,
+        .sustain = v->envelope.sustain,
+        .waveform = v->waveform,
+        .envelope = v->envelope.type,
+        .amplitude = v->amplitude,
+      };
+    }
+    if(write_all(fd, sizeof(*block) * n, block))
+      goto error;
+  }
+  if(close(fd) == -1){
+    fprintf(stderr, "%s:%u: close failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  if(rename(tmp, path) == -1){
+    fprintf(stderr, "%s:%u: rename failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+error:
+  close(fd);
+  unlink(tmp);
+  return -1;
+}
+
+int timeline_load(const char* path, struct timeline* t, const struct render_config* config, uint64_t source_hash){
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1){
+    if(errno == ENOENT)
+      return 1;
+    fprintf(stderr, "%s:%u: open failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1){
+    fprintf(stderr, "%s:%u: fstat failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if((size_t)st.st_size < sizeof(struct timeline_file_header)){
+    close(fd);
+    return 1;
+  }
+  void*const map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    fprintf(stderr, "%s:%u: mmap failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  int ret = 1;
+  const struct timeline_file_header*const header = map;
+  const struct timeline_file_voice*const voice = (const struct timeline_file_voice*)(header + 1);
+  if( memcmp(header->magic, TIMELINE_FILE_MAGIC, sizeof(header->magic))
+   || header->version != TIMELINE_FILE_VERSION
+   || header->byte_order != TIMELINE_FILE_BYTE_ORDER
+   || header->samples_per_second != config->samples_per_second
+   || (source_hash && header->source_hash != source_hash)
+   || header->count != (st.st_size - sizeof(*header)) / sizeof(*voice)
+   || (st.st_size - sizeof(*header)) % sizeof(*voice)
+  ) goto out;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  *t = (struct timeline){0};
+  if(!timeline_reserve(t, header->count)){
+    timeline_destroy(t);
+    ret = -1;
+    goto out;
+  }
+  for(size_t i=0; i<header->count; i++){
+    const struct timeline_file_voice*const v = &voice[i];
+    if(v->waveform >= WAVEFORM_COUNT || v->envelope >= ENVELOPE_TYPE_COUNT || v->sustain > ENVELOPE_MAX || (v->envelope == ENVELOPE_DECAY && !v->decay) || v->amplitude > VOICE_AMPLITUDE_MAX || (i && v->start < voice[i-1].start)){
+      fprintf(stderr, "%s: invalid voice %zu\n", path, i);
+      timeline_destroy(t);
+      ret = -1;
+      goto out;
+    }
+    struct voice loaded = {
+      .start = v->start,
+      .duration = v->duration,
+      .gate = v->gate,
+      .phase = v->phase,
+      .increment = v->increment,
+      .waveform = v->waveform,
+      .amplitude = v->amplitude,
+      .envelope = {
+        .type = v->envelope,
+        .sustain = v->sustain,
+        .attack = v->attack,
+        .decay = v->decay,
+        .release = v->release,
+      },
+    };
+    if(config->wavetable != WAVETABLE_OFF){
+      loaded.table = wavetable_get(v->waveform, v->increment);
+      if(!loaded.table){
+        timeline_destroy(t);
+        ret = -1;
+        goto out;
+      }
+    }
+    timeline_add(t, &loaded);
+  }
+  t->length = header->length;
+  t->end = header->end;
+  ret = 0;
+out:
+  munmap(map, st.st_size);
+  return ret;
+}
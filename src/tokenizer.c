@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <tokenizer.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Size of the chunks read from the input if it can't be mapped
+#define SOURCE_CHUNK_SIZE (1024 * 1024)
+
+int source_open(struct source* source, int fd){
+  *source = (struct source){0};
+  struct stat st;
+  if(fstat(fd, &st) == -1){
+    fprintf(stderr, "%s:%u: fstat failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    return -1;
+  }
+  // A regular file is read from its current offset, like it would be with read
+  const off_t offset = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : -1;
+  if(offset != -1 && st.st_size > offset){
+    const long page = sysconf(_SC_PAGESIZE);
+    const off_t start = offset / page * page;
+    void*const map = mmap(0, st.st_size - start, PROT_READ, MAP_PRIVATE, fd, start);
+    if(map != MAP_FAILED){
+      madvise(map, st.st_size - start, MADV_SEQUENTIAL);
+      source->data = (const char*)map + (offset - start);
+      source->size = st.st_size - offset;
+      source->mapped = true;
+      lseek(fd, st.st_size, SEEK_SET);
+      return 0;
+    }
+  }
+  size_t capacity = 0;
+  char* buffer = 0;
+  while(true){
+    if(capacity - source->size < SOURCE_CHUNK_SIZE){
+      capacity = capacity ? capacity * 2 : SOURCE_CHUNK_SIZE;
+      char* b = realloc(buffer, capacity);
+      if(!b){
+        fprintf(stderr, "%s:%u: realloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+        free(buffer);
+        return -1;
+      }
+      buffer = b;
+    }
+    ssize_t n = read(fd, buffer + source->size, capacity - source->size);
+    if(n == -1){
+      if(errno == EINTR)
+        continue;
+      fprintf(stderr, "%s:%u: read failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+      free(buffer);
+      return -1;
+    }
+    if(!n)
+      break;
+    source->size += n;
+  }
+  source->data = buffer;
+  return 0;
+}
+
+void source_close(struct source* source){
+  if(source->mapped){
+    const long page = sysconf(_SC_PAGESIZE);
+    const uintptr_t start = (uintptr_t)source->data / page * page;
+    munmap((void*)start, source->size + ((uintptr_t)source->data - start));
+  }else{
+    free((char*)source->data);
+  }
+  *source = (struct source){0};
+}
+
+void tokenizer_init(struct tokenizer* t, size_t size, const char data[size]){
+  *t = (struct tokenizer){
+    .next = data,
+    .position = data,
+    .line_end = data,
+    .end = data + size,
+  };
+}
+
+bool tokenizer_next_line(struct tokenizer* t){
+  if(t->next >= t->end)
+    return false;
+  const char* newline = memchr(t->next, '\n', t->end - t->next);
+  t->position = t->next;
+  t->line_end = newline ? newline : t->end;
+  t->next = newline ? newline + 1 : t->end;
+  return true;
+}
+
+static inline bool is_space(char c){
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool tokenizer_next(struct tokenizer* t, struct token* token){
+  const char* p = t->position;
+  while(p < t->line_end && is_space(*p))
+    p++;
+  if(p >= t->line_end){
+    t->position = p;
+    return false;
+  }
+  const char*const start = p;
+  while(p < t->line_end && !is_space(*p))
+    p++;
+  *token = (struct token){ .data = start, .length = p - start };
+  t->position = p;
+  return true;
+}
+
+bool token_parse_number(struct token* token, long double* value){
+  const char* p = token->data;
+  const char*const end = p + token->length;
+  bool negative = false;
+  if(p < end && (*p == '+' || *p == '-'))
+    negative = *p++ == '-';
+  long double v = 0;
+  int exponent = 0;
+  bool digits = false;
+  for(; p < end && *p >= '0' && *p <= '9'; p++, digits=true)
+    v = v * 10 + (*p - '0');
+  if(p < end && *p == '.')
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++, digits=true, exponent--)
+      v = v * 10 + (*p - '0');
+  if(!digits)
+    return false;
+  if(p + 1 < end && (*p == 'e' || *p == 'E')){
+    const char* q = p + 1;
+    bool negative_exponent = false;
+    if(q < end && (*q == '+' || *q == '-'))
+      negative_exponent = *q++ == '-';
+    if(q < end && *q >= '0' && *q <= '9'){
+      int e = 0;
+      for(; q < end && *q >= '0' && *q <= '9'; q++)
+        if(e < 100000)
+          e = e * 10 + (*q - '0');
+      exponent += negative_exponent ? -e : e;
+      p = q;
+    }
+  }
+  // A single rounding step, so integers and short decimal fractions come out the same as with strtold
+  if(exponent){
+    long double scale = 1, base = 10;
+    for(unsigned e = exponent < 0 ? -exponent : exponent; e; e >>= 1, base *= base)
+      if(e & 1)
+        scale *= base;
+    v = exponent < 0 ? v / scale : v * scale;
+  }
+  *value = negative ? -v : v;
+  token->length -= p - token->data;
+  token->data = p;
+  return true;
+}
+
+bool token_to_long(struct token token, long* value){
+  long double v;
+  if(!token_parse_number(&token, &v) || token.length || v != (long)v)
+    return false;
+  *value = v;
+  return true;
+}
@@ -0,0 +1,122 @@
+#include <wavetable.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Guard samples before and after a period
+#define GUARD_BEFORE 1
+#define GUARD_AFTER 2
+#define LEVEL_SIZE (GUARD_BEFORE + WAVETABLE_SIZE + GUARD_AFTER)
+
+const char*const wavetable_mode_name[WAVETABLE_MODE_COUNT] = {
+#define X(N, S) [N] = S,
+  WAVETABLE_MODES
+#undef X
+};
+
+static float* wavetable[WAVEFORM_COUNT];
+
+// Amplitude of the k-th harmonic (sine component), matching the waveforms in oscillator.c
+static double harmonic(enum waveform waveform, unsigned k){
+  switch(waveform){
+    case WAVEFORM_SIN: return k == 1;
+    case WAVEFORM_TRIANGLE: return k % 2 ? 8 / (M_PI * M_PI) / ((double)k * k) * (k % 4 == 1 ? 1 : -1) : 0;
+    case WAVEFORM_SQUARE: return k % 2 ? -4 / M_PI / k : 0; // Positive in the second half of the period
+    case WAVEFORM_COUNT: break;
+  }
+  return 0;
+}
+
+static float* wavetable_create(enum waveform waveform){
+  float* table = malloc(sizeof(float) * LEVEL_SIZE * WAVETABLE_LEVELS);
+  double*const sum = malloc(sizeof(double) * WAVETABLE_SIZE);
+  double*const sin_table = malloc(sizeof(double) * WAVETABLE_SIZE);
+  if(!table || !sum || !sin_table){
+    fprintf(stderr, "%s:%u: malloc failed (%d): %s\n", __FILE__, __LINE__, errno, strerror(errno));
+    free(table);
+    table = 0;
+    goto out;
+  }
+  for(unsigned i=0; i<WAVETABLE_SIZE; i++)
+    sin_table[i] = sin(2 * M_PI * i / WAVETABLE_SIZE);
+  // Go from the level with the fewest harmonics upwards, each level only needs to add the harmonics the previous lacked
+  memset(sum, 0, sizeof(double) * WAVETABLE_SIZE);
+  unsigned k = 1;
+  for(unsigned l=WAVETABLE_LEVELS; l--; ){
+    const unsigned harmonics = WAVETABLE_SIZE / 4 >> l;
+    for(; k<=harmonics; k++){
+      const double a = harmonic(waveform, k);
+      if(!a) continue;
+      for(unsigned i=0; i<WAVETABLE_SIZE; i++)
+        sum[i] += a * sin_table[(i * k) & (WAVETABLE_SIZE-1)];
+    }
+    // The gibbs phenomenon overshoots, scale it back into [-1, 1]
+    double peak = 1;
+    for(unsigned i=0; i<WAVETABLE_SIZE; i++)
+      if(peak < fabs(sum[i]))
+        peak = fabs(sum[i]);
+    float*const level = table + LEVEL_SIZE * l + GUARD_BEFORE;
+    for(unsigned i=0; i<WAVETABLE_SIZE; i++)
+      level[i] = sum[i] / peak;
+    level[-1] = level[WAVETABLE_SIZE-1];
+    level[WAVETABLE_SIZE  ] = level[0];
+    level[WAVETABLE_SIZE+1] = level[1];
+  }
+out:
+  free(sin_table);
+  free(sum);
+  return table;
+}
+
+const float* wavetable_get(enum waveform waveform, uint32_t increment){
+  if(!wavetable[waveform])
+    wavetable[waveform] = wavetable_create(waveform);
+  if(!wavetable[waveform])
+    return 0;
+  // The highest harmonic has to stay below the nyquist frequency, harmonics * increment < 2^31
+  unsigned l = 0;
+  while(l < WAVETABLE_LEVELS-1 && (uint64_t)(WAVETABLE_SIZE / 4 >> l) * increment >= 0x80000000u)
+    l++;
+  return wavetable[waveform] + LEVEL_SIZE * l + GUARD_BEFORE;
+}
+
+#define FRACTION_BITS (32 - WAVETABLE_SIZE_LOG2)
+
+static void render_linear(const float* table, size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment){
+    const uint32_t j = phase >> FRACTION_BITS;
+    const float t = (phase & ((1u << FRACTION_BITS) - 1)) * (1.0f / (1u << FRACTION_BITS));
+    const float a = table[j], b = table[j+1];
+    out[i] = (int32_t)((a + (b - a) * t) * 32767.0f);
+  }
+}
+
+// Catmull-Rom spline through the 4 closest samples
+static void render_cubic(const float* table, size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  for(size_t i=0; i<n; i++, phase+=increment){
+    const uint32_t j = phase >> FRACTION_BITS;
+    const float t = (phase & ((1u << FRACTION_BITS) - 1)) * (1.0f / (1u << FRACTION_BITS));
+    const float y0 = table[(int32_t)j-1], y1 = table[j], y2 = table[j+1], y3 = table[j+2];
+    const float c1 = 0.5f * (y2 - y0);
+    const float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+    const float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+    float v = ((c3 * t + c2) * t + c1) * t + y1;
+    // The spline can slightly overshoot the samples
+    if(v > 1) v = 1;
+    if(v < -1) v = -1;
+    out[i] = (int32_t)(v * 32767.0f);
+  }
+}
+
+void wavetable_render(enum wavetable_mode mode, const float* table, size_t n, int16_t out[restrict n], uint32_t phase, uint32_t increment){
+  switch(mode){
+    case WAVETABLE_CUBIC: render_cubic(table, n, out, phase, increment); break;
+    default: render_linear(table, n, out, phase, increment); break;
+  }
+}